@@ -0,0 +1,34 @@
+/*
+    Created By: Hector Soto
+    Atomic loads/stores used by queues made with HS_QUEUE_LOCK_FREE.
+    The Linux build compiles as C++ and MSVC compiles as C, so neither <stdatomic.h> nor <atomic> works for both.
+*/
+#ifndef _HS_ATOMICS_H
+#define _HS_ATOMICS_H
+
+#ifdef _WIN32 //Interlocked calls are full barriers, stronger than what's asked for.
+    #define HS_LoadAcquire(P) ((ULONG)InterlockedOr((volatile LONG *)(P), 0))
+    #define HS_LoadRelaxed(P) (*(volatile ULONG *)(P))
+    #define HS_StoreRelease(P, V) InterlockedExchange((volatile LONG *)(P), (LONG)(V))
+    #define HS_FetchAdd(P, V) ((ULONG)InterlockedExchangeAdd((volatile LONG *)(P), (LONG)(V)))
+    #define HS_Fence() MemoryBarrier()
+    #define HS_StoreRelaxed(P, V) (*(volatile ULONG *)(P) = (ULONG)(V))
+    #define HS_LoadRelaxed64(P) ((ULONGLONG)InterlockedCompareExchange64((volatile LONGLONG *)(P), 0, 0))
+    #define HS_StoreRelaxed64(P, V) InterlockedExchange64((volatile LONGLONG *)(P), (LONGLONG)(V))
+    #define HS_AddRelaxed64(P, V) InterlockedExchangeAdd64((volatile LONGLONG *)(P), (LONGLONG)(V))
+    #define HS_AddOwned64(P, V) HS_AddRelaxed64(P, V) //32-bit Windows can't store 64 bits atomically without it.
+#else //For Linux/macOS, GCC/Clang builtins.
+    #define HS_LoadAcquire(P) __atomic_load_n((P), __ATOMIC_ACQUIRE)
+    #define HS_LoadRelaxed(P) __atomic_load_n((P), __ATOMIC_RELAXED)
+    #define HS_StoreRelease(P, V) __atomic_store_n((P), (V), __ATOMIC_RELEASE)
+    #define HS_FetchAdd(P, V) __atomic_fetch_add((P), (V), __ATOMIC_SEQ_CST)
+    #define HS_Fence() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+    #define HS_StoreRelaxed(P, V) __atomic_store_n((P), (V), __ATOMIC_RELAXED)
+    #define HS_LoadRelaxed64(P) __atomic_load_n((P), __ATOMIC_RELAXED)
+    #define HS_StoreRelaxed64(P, V) __atomic_store_n((P), (V), __ATOMIC_RELAXED)
+    #define HS_AddRelaxed64(P, V) __atomic_fetch_add((P), (V), __ATOMIC_RELAXED)
+    //Add for counters with a single writer, skips the locked instruction.
+    #define HS_AddOwned64(P, V) __atomic_store_n((P), __atomic_load_n((P), __ATOMIC_RELAXED) + (V), __ATOMIC_RELAXED)
+#endif //_WIN32
+
+#endif //_HS_ATOMICS_H
@@ -1,577 +1,2504 @@
 #ifdef _WIN32
     #include "pch.h"
     #include <processthreadsapi.h>
+    #define DeleteConditionVariable(A) //Windows condition variables don't need to be deleted.
 #else //For Linux/macOS
     #include "HS_processthreadsapi.h"
+    #include <sys/eventfd.h>
+    #include <unistd.h>
     #define HS_
 #endif //_WIN32
 #include <stdlib.h>
 //#include <stdio.h>
 #include <string.h>
 #include "QueueD3XX.h"
+#include "HS_QueueD3XX.h"
+#include "HS_Atomics.h"
 
-#define QUEUE_D3XX_VERSION 0x01000011
+#define QUEUE_D3XX_VERSION 0x0100002D
+#define HS_REACTOR_MAX_QUEUES 8 //A device has at most 4 IN and 4 OUT pipes.
+#define HS_REACTOR_SPINS 64 //Sweeps a reactor yields for before sleeping while transfers are in flight.
+#define HS_REACTOR_SLEEP_MS 1 //How long a reactor sleeps between sweeps while transfers are in flight.
+#define HS_LATENCY_SUB_BITS 4 //Each power of two of a latency histogram is split into 2^HS_LATENCY_SUB_BITS buckets.
+#define HS_LATENCY_STAGES 3
+#define HS_USB3_PACKET 1024 //Bytes in a USB 3 bulk packet, URBs are sized in whole packets.
+#define HS_URB_MAX_SIZE 0x100000 //Largest URB HS_OpenEx() derives, bigger streams span several URBs.
+#define HS_WATCHDOG_CHECKS 2 //Times per StallMs the watchdog checks a queue.
+#define HS_DEVICE_PIPES (2 * HS_FIFO_COUNT) //Pipe table of a handle, OUT pipes 0x02 to 0x05 then IN pipes 0x82 to 0x85.
+#define HS_DEVICE_BUCKETS 16 //Buckets of DeviceTable, a process has a handful of devices at most.
+#define HS_RECOVER_TRIES 3 //Recoveries in a row a HS_QUEUE_RECOVER queue makes before handing the failure to the user.
 
 typedef struct _HS_Buffer{
     FT_STATUS Status; //Return value of the read/write pipe call.
-    PUCHAR Buffer; //Buffer, must be freed by end user if not NULL.
+    PUCHAR Buffer; //Buffer, points into the queue's PoolData.
     ULONG BytesTransferred; //Bytes transferred.
+    ULONG Length; //Bytes to read/write, at most StreamSize.
     OVERLAPPED Overlap; //Overlap for the buffer.
-    struct _HS_Buffer *Next;
-    struct _HS_Buffer *Prev;
+    BOOL Lent; //If true, the user is holding the buffer from HS_AcquireReadBuffer() or HS_AcquireWriteBuffer().
+    ULONGLONG QueuedNs; //When the buffer was added to the ring. Only set by HS_QUEUE_TIMING queues.
+    ULONGLONG PostNs; //When its read/write pipe call was made. Only set by HS_QUEUE_TIMING queues.
+    ULONGLONG DoneNs; //When its overlap finished. Only set by HS_QUEUE_TIMING queues.
+    BOOL Finished; //If true, _FinishRecovery() already got its result into Status and BytesTransferred.
+    struct _HS_Buffer *Next; //Links buffers in the queue's Pool.
 } HS_Buffer;
 
+/*
+    A HS_WaitAny() call, on its stack. Queues it waits on wake it through Cond.
+*/
+typedef struct _HS_Waiter{
+    CRITICAL_SECTION Mutex;
+    CONDITION_VARIABLE Cond;
+} HS_Waiter;
+
+typedef struct _HS_WaitNode{ //Links a HS_Waiter into one queue's Waiters.
+    HS_Waiter *Waiter;
+    struct _HS_WaitNode *Prev;
+    struct _HS_WaitNode *Next;
+} HS_WaitNode;
+
 typedef struct _Queue{
     FT_HANDLE Handle;
     UCHAR PipeID;
     ULONG StreamSize; //Size of read/write pipe calls.
     ULONG QueueLength; //Max size of the queue.
-    ULONG Size; //Current size of the queue.
-    ULONG SizeWS; //Size of WriteStatus.
-    BOOL Active; //If true, a thread is actively using this queue.
-    CRITICAL_SECTION ActiveMutex;
+    BOOL LockFree; //If true, made with HS_QUEUE_LOCK_FREE. Ring indices are handed off with atomics instead of BuffersMutex.
+    struct _HS_Reactor *Reactor; //If not NULL, made with HS_QUEUE_REACTOR. The reactor's thread is our _QueueRequester.
+    BOOL Active; //If true, a thread is actively using this queue. Written under BuffersMutex.
+    ULONG UserWaiting; //User calls sleeping on UserCond. Only used by lock free queues.
+    ULONG RequesterWaiting; //Non zero while _QueueRequester sleeps on RequesterCond. Only used by lock free queues.
+    HS_WaitNode *Waiters; //HS_WaitAny() calls waiting on the queue. Guarded by BuffersMutex.
+    ULONG AnyWaiting; //Number of Waiters, so lock free queues can skip the lock.
     CRITICAL_SECTION BuffersMutex;
+    CONDITION_VARIABLE RequesterCond; //Wakes _QueueRequester when it has work to do or must stop.
+    CONDITION_VARIABLE UserCond; //Wakes user calls waiting on the queue.
     DWORD ThreadID;
     HANDLE ThreadHandle;
-    struct _Queue *Prev;
-    struct _Queue *Next;
-    HS_Buffer *Buffers; //Our queue of buffers.
-    HS_Buffer *WriteStatus; //Our queue of the status of past write pipe calls.
+    struct _HS_Device *Device; //Device of Handle, the queue is in its pipe table until HS_DestroyQueue() is done.
+    BOOL Closing; //If true, HS_DestroyQueue() or HS_ReattachDevice() is stopping the queue. Guarded by QueueListMutex.
+    HS_Buffer **Ring; //QueueLength slots holding buffers in the order they were added.
+    //Ring indices run from 0 to 2*QueueLength-1 so a full ring and an empty ring look different.
+    //Each index has one writer. Done buffers are Head to Reap, posted are Reap to Post, queued are Post to Tail.
+    ULONG Head; //Oldest done buffer, the next one handed to the user. Written by the user.
+    ULONG Reap; //Oldest posted buffer _QueueRequester hasn't gotten the result of yet. Written by _QueueRequester.
+    ULONG Post; //Oldest buffer waiting to be posted. Written by _QueueRequester.
+    ULONG Tail; //Where the next buffer is added. Written by _QueueRequester (IN) or the user (OUT).
+    ULONG Depth; //Most buffers posted at once, Reap to Post. Written by HS_SetQueueDepth().
+    HS_Buffer *Pool; //Buffers not in use, singly linked through Next. Only touched by whoever takes buffers.
+    HS_Buffer **Returned; //QueueLength slots of buffers given back by the other side, picked up into Pool.
+    ULONG RetHead; //Returned index of the oldest buffer not picked up yet. Written by whoever takes buffers.
+    ULONG RetTail; //Returned index the next buffer is given back at. Written by whoever gives back buffers.
+    HS_Buffer *PoolBuffers; //All QueueLength buffers followed by Ring and Returned, allocated once by _CreatePool.
+    PUCHAR PoolData; //Data of all buffers, StreamSize bytes each.
+    ULONG Allocations; //Number of heap allocations made for buffers. Doesn't change after creation.
+    //Counters for HS_GetQueueStats(), updated with relaxed atomics. Each is written by one side unless noted.
+    HS_QUEUE_STATS Stats; //Transfer counts by _ReapBuffer(), full counts and HighWater by the side taking buffers.
+    ULONGLONG FullSince; //When the queue became full, 0 if it isn't. Only used by the side taking buffers.
+    BOOL Timed; //If true, made with HS_QUEUE_TIMING.
+    //HS_LATENCY_STAGES histograms, allocated by _CreatePool if Timed. Each stage is written by one side, Count isn't used.
+    HS_LATENCY_HISTOGRAM *Latency;
+    HS_READ_CALLBACK Callback; //If not NULL, _QueueRequester hands every finished read to it instead of the user.
+    PVOID CallbackContext;
+    BOOL Stopped; //If true, a callback queue got a failed read and stopped reading. Only used by _QueueRequester.
+    int EventFd; //eventfd from HS_GetQueueEventFd(), -1 until it's asked for. Set once under BuffersMutex.
+    ULONG StallMs; //Watchdog aborts the pipe after this long without a transfer finishing. 0 is off.
+    ULONGLONG ProgressNs; //When a transfer last finished or was posted with none in flight. Written by _QueueRequester.
+    ULONGLONG AbortNs; //When the watchdog last aborted the pipe. Only used by the watchdog.
+    BOOL Stalled; //Set by the watchdog before it aborts, failures from then on are recovered. Cleared once a result is handed out.
+    BOOL Recover; //If true, made with HS_QUEUE_RECOVER.
+    ULONG Retries; //Recoveries since a transfer last finished. Only used by _QueueRequester.
+    BOOL Paused; //If true, nothing is posted. Failed transfers are posted again on resume. Written by HS_PauseQueue().
+    BOOL AbortWanted; //Set by HS_PauseQueue() for HS_PAUSE_ABORT, cleared by _AbortInFlight().
+    BOOL Recovering; //If true, _RecoverPipe() aborted the pipe and nothing is posted until _FinishRecovery() is done.
+    ULONG Flags; //HS_QUEUE_ flags it was made with, HS_ReattachDevice() restarts it with them.
+    DWORD PipeTimeoutMs; //Last pipe timeout set by HS_SetQueueTimeout(), 0 if none. Written under QueueListMutex.
+    BOOL StallAbort; //If true, the watchdog is aborting the pipe without QueueListMutex. Guarded by QueueListMutex.
+    struct _Queue *NextStall; //Links the queues the watchdog aborts after a sweep. Only used by the watchdog.
 } HS_Queue;
 
-HS_Queue *QueueList = NULL;
-ULONG QueueSize = 0;
-CRITICAL_SECTION QueueListMutex;
+/*
+    One thread servicing every HS_QUEUE_REACTOR queue of a handle.
+    Lock order is ListMutex, then a queue's BuffersMutex, then SleepMutex.
+*/
+typedef struct _HS_Reactor{
+    HS_Queue *Queues[HS_REACTOR_MAX_QUEUES]; //Guarded by ListMutex.
+    ULONG QueueCount; //Guarded by ListMutex.
+    BOOL Active; //If true, the reactor's thread keeps running. Written under SleepMutex.
+    ULONG Kicks; //Bumped by _WakeRequester() so a sleeping reactor knows it missed nothing.
+    ULONG Waiting; //Non zero while the reactor's thread sleeps on Cond.
+    CRITICAL_SECTION ListMutex; //Held while the reactor's thread sweeps the queues.
+    CRITICAL_SECTION SleepMutex;
+    CONDITION_VARIABLE Cond; //Wakes the reactor's thread when a queue has work or it must stop.
+    DWORD ThreadID;
+    HANDLE ThreadHandle;
+} HS_Reactor;
+
+/*
+    Queues of one handle, indexed by _PipeIndex(). Made with the handle's first queue and freed with its last.
+*/
+typedef struct _HS_Device{
+    FT_HANDLE Handle;
+    HS_Queue *Queues[HS_DEVICE_PIPES]; //Queues being destroyed stay until their thread is stopped. Guarded by QueueListMutex.
+    ULONG QueueCount; //Guarded by QueueListMutex.
+    CRITICAL_SECTION ReactorMutex; //Held while a queue is added to or taken off Reactor, across the reactor's join.
+    HS_Reactor *Reactor; //Guarded by ReactorMutex.
+    struct _HS_Device *Next; //Next device in the same DeviceTable bucket.
+} HS_Device;
+
+/*
+    Derived transfer params of a handle opened by HS_OpenEx(), HS_ReattachDevice() applies them again.
+*/
+typedef struct _HS_OpenParams{
+    FT_HANDLE Handle;
+    HS_TRANSFER_CONFIG PerFifo[HS_FIFO_COUNT];
+    struct _HS_OpenParams *Next;
+} HS_OpenParams;
+
+HS_Device *DeviceTable[HS_DEVICE_BUCKETS]; //Devices by handle, see _DeviceBucket(). Guarded by QueueListMutex.
+ULONG QueueSize = 0; //Queues in every pipe table. Guarded by QueueListMutex.
+CRITICAL_SECTION QueueListMutex; //Only held for short lookups, never while a thread is joined.
+BOOL QueueListReady = FALSE; //If true, QueueListMutex is initialized. Cleared when _FreeQueueList() deletes it.
+HANDLE WatchdogThread = NULL; //Started by the first HS_SetQueueTimeout() with a StallMs. Guarded by QueueListMutex.
+DWORD WatchdogThreadID;
+BOOL WatchdogActive = FALSE; //Guarded by QueueListMutex.
+FT_DEVICE_LIST_INFO_NODE *DeviceInfo = NULL; //Device list of the last HS_RefreshDevices(). Guarded by DeviceInfoMutex.
+ULONG DeviceInfoCount = 0; //Guarded by DeviceInfoMutex.
+HS_OpenParams *OpenParams = NULL; //Params of every open HS_OpenEx() handle. Guarded by OpenMutex.
+CRITICAL_SECTION OpenMutex; //Held by _CreateHandle() from applying the transfer params until the handle is made.
+CRITICAL_SECTION DeviceInfoMutex; //Held while the device list is made, apart from QueueListMutex so queues aren't held up.
+CONDITION_VARIABLE WatchdogCond; //Wakes the watchdog when it must stop or a queue's StallMs changed.
+CONDITION_VARIABLE StallAbortCond; //Wakes calls waiting for the watchdog to clear a queue's StallAbort.
+HS_D3XX_BACKEND D3XX; //Every D3XX call goes through here. Only changed by HS_SetBackend() while no queues exist.
+
+#ifndef _QUEUE_D3XX_SIM_ONLY
+/*
+    Calls into the D3XX library for HS_D3XX_BACKEND. Keeps WINAPI calls and Linux's FIFO IDs out of the table.
+*/
+FT_STATUS _VendorCreate(PVOID Arg, DWORD Flags, FT_HANDLE *Handle){return FT_Create(Arg, Flags, Handle);}
+FT_STATUS _VendorClose(FT_HANDLE Handle){return FT_Close(Handle);}
+FT_STATUS _VendorReadPipe(FT_HANDLE Handle, UCHAR PipeID, PUCHAR Buffer, ULONG Length, PULONG BytesTransferred, LPOVERLAPPED Overlapped)
+{
+    #ifdef _WIN32
+        return FT_ReadPipe(Handle, PipeID, Buffer, Length, BytesTransferred, Overlapped);
+    #else
+        return FT_ReadPipeAsync(Handle, (PipeID&0x07)-2, Buffer, Length, BytesTransferred, Overlapped); //Linux uses FIFO ID.
+    #endif //_WIN32
+}
+FT_STATUS _VendorWritePipe(FT_HANDLE Handle, UCHAR PipeID, PUCHAR Buffer, ULONG Length, PULONG BytesTransferred, LPOVERLAPPED Overlapped)
+{
+    #ifdef _WIN32
+        return FT_WritePipe(Handle, PipeID, Buffer, Length, BytesTransferred, Overlapped);
+    #else
+        return FT_WritePipeAsync(Handle, (PipeID&0x07)-2, Buffer, Length, BytesTransferred, Overlapped); //Linux uses FIFO ID.
+    #endif //_WIN32
+}
+FT_STATUS _VendorGetOverlappedResult(FT_HANDLE Handle, LPOVERLAPPED Overlapped, PULONG BytesTransferred, BOOL Wait)
+{
+    return FT_GetOverlappedResult(Handle, Overlapped, BytesTransferred, Wait);
+}
+FT_STATUS _VendorInitializeOverlapped(FT_HANDLE Handle, LPOVERLAPPED Overlapped){return FT_InitializeOverlapped(Handle, Overlapped);}
+FT_STATUS _VendorReleaseOverlapped(FT_HANDLE Handle, LPOVERLAPPED Overlapped){return FT_ReleaseOverlapped(Handle, Overlapped);}
+FT_STATUS _VendorSetStreamPipe(FT_HANDLE Handle, BOOL AllWritePipes, BOOL AllReadPipes, UCHAR PipeID, ULONG StreamSize)
+{
+    return FT_SetStreamPipe(Handle, AllWritePipes, AllReadPipes, PipeID, StreamSize);
+}
+FT_STATUS _VendorClearStreamPipe(FT_HANDLE Handle, BOOL AllWritePipes, BOOL AllReadPipes, UCHAR PipeID)
+{
+    return FT_ClearStreamPipe(Handle, AllWritePipes, AllReadPipes, PipeID);
+}
+FT_STATUS _VendorAbortPipe(FT_HANDLE Handle, UCHAR PipeID){return FT_AbortPipe(Handle, PipeID);}
+FT_STATUS _VendorSetPipeTimeout(FT_HANDLE Handle, UCHAR PipeID, DWORD TimeoutMs){return FT_SetPipeTimeout(Handle, PipeID, TimeoutMs);}
+FT_STATUS _VendorCreateDeviceInfoList(LPDWORD NumDevices){return FT_CreateDeviceInfoList(NumDevices);}
+FT_STATUS _VendorGetDeviceInfoList(FT_DEVICE_LIST_INFO_NODE *List, LPDWORD NumDevices){return FT_GetDeviceInfoList(List, NumDevices);}
+FT_STATUS _VendorSetTransferParams(const HS_TRANSFER_CONFIG *Config, ULONG FifoID)
+{
+    #ifdef _WIN32
+        return FT_OK; //The Windows driver sizes its own transfers.
+    #else
+        ULONG i;
+        FT_TRANSFER_CONF Conf;
+        memset(&Conf, 0, sizeof(FT_TRANSFER_CONF)); //fNonThreadSafeTransfer stays FALSE, pipes are aborted from other threads.
+        Conf.wStructSize = sizeof(FT_TRANSFER_CONF);
+        for(i = 0; i < FT_PIPE_DIR_COUNT; ++i)
+        {
+            Conf.pipe[i].fPipeNotUsed = (Config->Flags & ((i == FT_PIPE_DIR_IN) ? HS_TRANSFER_NO_IN : HS_TRANSFER_NO_OUT)) ? TRUE : FALSE;
+            Conf.pipe[i].bURBCount = (BYTE)Config->URBCount;
+            Conf.pipe[i].wURBBufferCount = (WORD)Config->URBBufferCount;
+            Conf.pipe[i].dwURBBufferSize = Config->URBBufferSize;
+            Conf.pipe[i].dwStreamingSize = Config->StreamingSize;
+        }
+        return FT_SetTransferParams(&Conf, FifoID);
+    #endif //_WIN32
+}
+
+const HS_D3XX_BACKEND VendorBackend = {_VendorCreate, _VendorClose, _VendorReadPipe, _VendorWritePipe,
+                                       _VendorGetOverlappedResult, _VendorInitializeOverlapped, _VendorReleaseOverlapped,
+                                       _VendorSetStreamPipe, _VendorClearStreamPipe, _VendorAbortPipe,
+                                       _VendorSetTransferParams, _VendorSetPipeTimeout,
+                                       _VendorCreateDeviceInfoList, _VendorGetDeviceInfoList};
+#define HS_DEFAULT_BACKEND VendorBackend
+#else
+#define HS_DEFAULT_BACKEND SimBackend //Built without the D3XX library.
+#endif //_QUEUE_D3XX_SIM_ONLY
+
+/*
+    Returns the slot of PipeID in a device's pipe table, HS_DEVICE_PIPES if it isn't a FT60x pipe.
+*/
+ULONG _PipeIndex(UCHAR PipeID)
+{
+    ULONG Fifo = (ULONG)(PipeID & 0x7F) - 2; //Wraps for pipes below 0x02.
+    if(Fifo >= HS_FIFO_COUNT){return HS_DEVICE_PIPES;}
+    return Fifo + ((PipeID & 0x80) ? HS_FIFO_COUNT : 0);
+}
+
+/*
+    Returns the DeviceTable bucket of a handle. Handles are heap pointers, the low bits are alignment.
+*/
+ULONG _DeviceBucket(FT_HANDLE Handle){return (ULONG)(((size_t)Handle >> 4) % HS_DEVICE_BUCKETS);}
+
+/*
+    Returns any queue not being destroyed, NULL if there are none. QueueListMutex must be held.
+*/
+HS_Queue *_FirstQueue()
+{
+    ULONG i, j;
+    HS_Device *Device = NULL;
+    for(i = 0; i < HS_DEVICE_BUCKETS; ++i)
+    {
+        for(Device = DeviceTable[i]; Device; Device = Device->Next)
+        {
+            for(j = 0; j < HS_DEVICE_PIPES; ++j)
+            {
+                if(Device->Queues[j] && !Device->Queues[j]->Closing){return Device->Queues[j];}
+            }
+        }
+    }
+    return NULL;
+}
+
+/*
+    Puts the queue into its handle's pipe table, making the handle's device for its first queue.
+    Returns FT_RESERVED_PIPE if the pipe already has a queue. QueueListMutex must be held.
+*/
+FT_STATUS _ClaimPipe(HS_Queue *Queue)
+{
+    HS_Device **Link = &DeviceTable[_DeviceBucket(Queue->Handle)];
+    ULONG Pipe = _PipeIndex(Queue->PipeID);
+    while(*Link && ((*Link)->Handle != Queue->Handle)){Link = &(*Link)->Next;}
+    if(!(*Link))
+    {
+        *Link = malloc(sizeof(HS_Device));
+        if(!(*Link)){return FT_NO_SYSTEM_RESOURCES;}
+        memset(*Link, 0, sizeof(HS_Device));
+        (*Link)->Handle = Queue->Handle;
+        InitializeCriticalSection(&(*Link)->ReactorMutex);
+    }
+    else if((*Link)->Queues[Pipe]){return FT_RESERVED_PIPE;} //Return if a queue already exists for the given pipe & handle.
+    (*Link)->Queues[Pipe] = Queue;
+    (*Link)->QueueCount += 1;
+    Queue->Device = *Link;
+    QueueSize += 1;
+    return FT_OK;
+}
+
+/*
+    Takes the pipe's queue out of the device's pipe table, freeing the device with its last queue.
+    QueueListMutex must be held.
+*/
+void _ReleasePipe(HS_Device *Device, UCHAR PipeID)
+{
+    HS_Device **Link = &DeviceTable[_DeviceBucket(Device->Handle)];
+    Device->Queues[_PipeIndex(PipeID)] = NULL;
+    Device->QueueCount -= 1;
+    QueueSize -= 1;
+    if(Device->QueueCount){return;}
+    while(*Link != Device){Link = &(*Link)->Next;}
+    *Link = Device->Next;
+    DeleteCriticalSection(&Device->ReactorMutex);
+    free(Device);
+}
 
 void _InitQueueList()
 {
-    QueueList = NULL;
+    memset(DeviceTable, 0, sizeof(DeviceTable));
     QueueSize = 0;
+    D3XX = HS_DEFAULT_BACKEND;
+    DeviceInfo = NULL; DeviceInfoCount = 0;
+    OpenParams = NULL;
     InitializeCriticalSection(&QueueListMutex);
+    InitializeCriticalSection(&OpenMutex);
+    InitializeCriticalSection(&DeviceInfoMutex);
+    InitializeConditionVariable(&WatchdogCond);
+    InitializeConditionVariable(&StallAbortCond);
+    QueueListReady = TRUE;
     //printf("INIT!\n");
 }
 
 void _FreeQueueList()
 {
     //printf("EXIT!\n");
-    if(!QueueList){return;}
-    HS_Queue *Temp = QueueList;
-    while(QueueList)
+    if(!QueueListReady){return;} //Already freed by HS_FreeQueueD3XX().
+    _StopWatchdog();
+    EnterCriticalSection(&QueueListMutex);
+    HS_Queue *Temp = _FirstQueue();
+    LeaveCriticalSection(&QueueListMutex);
+    while(Temp)
+    {
+        HS_DestroyQueue(Temp);
+        EnterCriticalSection(&QueueListMutex);
+        Temp = _FirstQueue();
+        LeaveCriticalSection(&QueueListMutex);
+    }
+    free(DeviceInfo);
+    DeviceInfo = NULL; DeviceInfoCount = 0;
+    while(OpenParams) //Handles the user didn't close.
+    {
+        HS_OpenParams *Next = OpenParams->Next;
+        free(OpenParams);
+        OpenParams = Next;
+    }
+    QueueListReady = FALSE;
+    DeleteCriticalSection(&QueueListMutex);
+    DeleteCriticalSection(&OpenMutex);
+    DeleteCriticalSection(&DeviceInfoMutex);
+}
+
+/*
+    Allocates all QueueLength buffers, their data and their overlaps up front.
+    Buffers are recycled through Queue->Pool so read/write calls never allocate memory.
+*/
+FT_STATUS _CreatePool(HS_Queue *Queue)
+{
+    ULONG i;
+    HS_Buffer *Temp = NULL;
+    if(Queue->QueueLength > 0x7FFFFFFF){return FT_INVALID_PARAMETER;} //Ring indices go up to 2*QueueLength.
+    if(((size_t)-1) / Queue->StreamSize < Queue->QueueLength){return FT_NO_SYSTEM_RESOURCES;} //Too big to allocate.
+    if(((size_t)-1) / (sizeof(HS_Buffer) + 2 * sizeof(HS_Buffer *)) < Queue->QueueLength){return FT_NO_SYSTEM_RESOURCES;}
+    Queue->PoolBuffers = malloc((sizeof(HS_Buffer) + 2 * sizeof(HS_Buffer *)) * Queue->QueueLength);
+    Queue->PoolData = malloc((size_t)Queue->StreamSize * Queue->QueueLength);
+    Queue->Allocations += 2;
+    if((!Queue->PoolBuffers) || (!Queue->PoolData))
+    {
+        free(Queue->PoolBuffers); free(Queue->PoolData);
+        Queue->PoolBuffers = NULL; Queue->PoolData = NULL;
+        return FT_NO_SYSTEM_RESOURCES;
+    }
+    if(Queue->Timed)
+    {
+        Queue->Latency = malloc(sizeof(HS_LATENCY_HISTOGRAM) * HS_LATENCY_STAGES);
+        Queue->Allocations += 1;
+        if(!Queue->Latency)
+        {
+            free(Queue->PoolBuffers); free(Queue->PoolData);
+            Queue->PoolBuffers = NULL; Queue->PoolData = NULL;
+            return FT_NO_SYSTEM_RESOURCES;
+        }
+        memset(Queue->Latency, 0, sizeof(HS_LATENCY_HISTOGRAM) * HS_LATENCY_STAGES);
+    }
+    Queue->Ring = (HS_Buffer **)(Queue->PoolBuffers + Queue->QueueLength);
+    Queue->Returned = Queue->Ring + Queue->QueueLength;
+    for(i = 0; i < Queue->QueueLength; ++i)
+    {
+        Temp = &Queue->PoolBuffers[i];
+        Temp->Buffer = Queue->PoolData + ((size_t)Queue->StreamSize * i);
+        Temp->Lent = FALSE;
+        if(D3XX.InitializeOverlapped(Queue->Handle, &Temp->Overlap) != FT_OK)
+        {
+            while(i--){D3XX.ReleaseOverlapped(Queue->Handle, &Queue->PoolBuffers[i].Overlap);}
+            free(Queue->PoolBuffers); free(Queue->PoolData); free(Queue->Latency);
+            Queue->PoolBuffers = NULL; Queue->PoolData = NULL; Queue->Pool = NULL; Queue->Ring = NULL; Queue->Returned = NULL;
+            Queue->Latency = NULL;
+            return FT_NO_SYSTEM_RESOURCES;
+        }
+        Temp->Next = Queue->Pool; //Add to pool.
+        Queue->Pool = Temp;
+    }
+    return FT_OK;
+}
+
+/*
+    Releases the overlaps of the first Count buffers and leaves the queue detached, without a handle.
+    The queue's thread must be stopped.
+*/
+void _DetachQueue(HS_Queue *Queue, ULONG Count)
+{
+    ULONG i;
+    for(i = 0; i < Count; ++i){D3XX.ReleaseOverlapped(Queue->Handle, &Queue->PoolBuffers[i].Overlap);}
+    Queue->Handle = NULL;
+}
+
+/*
+    Releases all overlaps and frees the memory allocated by _CreatePool.
+    The queue's thread must be stopped.
+*/
+void _DestroyPool(HS_Queue *Queue)
+{
+    if(!Queue->PoolBuffers){return;}
+    if(Queue->Handle){_DetachQueue(Queue, Queue->QueueLength);} //A failed reattach already released them.
+    free(Queue->PoolBuffers); free(Queue->PoolData); free(Queue->Latency);
+    Queue->PoolBuffers = NULL; Queue->PoolData = NULL; Queue->Pool = NULL; Queue->Ring = NULL; Queue->Returned = NULL;
+    Queue->Latency = NULL;
+}
+
+/*
+    Returns the ring index after Index. Works for Ring and Returned.
+*/
+ULONG _RingNext(HS_Queue *Queue, ULONG Index)
+{
+    return (Index + 1 == 2 * Queue->QueueLength) ? 0 : Index + 1;
+}
+
+/*
+    Returns the ring index before Index.
+*/
+ULONG _RingPrev(HS_Queue *Queue, ULONG Index)
+{
+    return Index ? Index - 1 : 2 * Queue->QueueLength - 1;
+}
+
+/*
+    Returns the slot of ring index Index.
+*/
+ULONG _RingSlot(HS_Queue *Queue, ULONG Index)
+{
+    return (Index >= Queue->QueueLength) ? Index - Queue->QueueLength : Index;
+}
+
+/*
+    Returns the number of buffers from ring index From up to To.
+*/
+ULONG _RingCount(HS_Queue *Queue, ULONG From, ULONG To)
+{
+    return (To >= From) ? To - From : To + 2 * Queue->QueueLength - From;
+}
+
+/*
+    Returns TRUE if a buffer is queued and Depth allows posting it. Only called by _QueueRequester or a reactor.
+*/
+BOOL _CanPost(HS_Queue *Queue)
+{
+    if(Queue->Post == HS_LoadAcquire(&Queue->Tail)){return FALSE;} //Nothing queued.
+    if(HS_LoadAcquire(&Queue->Paused) || Queue->Recovering){return FALSE;}
+    return _RingCount(Queue, Queue->Reap, Queue->Post) < HS_LoadRelaxed(&Queue->Depth);
+}
+
+/*
+    Returns the latency histogram bucket counting Ns. See HS_LATENCY_HISTOGRAM.
+*/
+ULONG _LatencyBucket(ULONGLONG Ns)
+{
+    ULONG Shift = 0, Step;
+    for(Step = 32; Step; Step >>= 1) //Find the largest Shift leaving HS_LATENCY_SUB_BITS + 1 bits of Ns.
+    {
+        if((Ns >> (Shift + Step)) >= (1ULL << HS_LATENCY_SUB_BITS)){Shift += Step;}
+    }
+    if(((Shift + 1) << HS_LATENCY_SUB_BITS) >= HS_LATENCY_BUCKETS){return HS_LATENCY_BUCKETS - 1;} //Too big, clamp.
+    return (Shift << HS_LATENCY_SUB_BITS) + (ULONG)(Ns >> Shift);
+}
+
+/*
+    Adds Ns to a latency histogram. Each histogram has one writer, readers use HS_GetQueueLatency().
+*/
+void _RecordLatency(HS_LATENCY_HISTOGRAM *Histogram, ULONGLONG Ns)
+{
+    HS_AddOwned64(&Histogram->Buckets[_LatencyBucket(Ns)], 1);
+    HS_AddOwned64(&Histogram->TotalNs, Ns);
+    if(Ns > Histogram->MaxNs){HS_StoreRelaxed64(&Histogram->MaxNs, Ns);}
+}
+
+/*
+    Counts the queue becoming full for HS_GetQueueStats(). Only called by the side that takes buffers.
+*/
+void _MarkFull(HS_Queue *Queue)
+{
+    if(Queue->FullSince){return;} //Already full.
+    Queue->FullSince = _GetTimeNs();
+    HS_AddOwned64(&Queue->Stats.FullCount, 1);
+}
+
+/*
+    Takes a buffer out of the pool. Returns NULL if the queue is full.
+    Only called by the side that takes buffers: _QueueRequester (IN) or the user writing (OUT).
+    BuffersMutex must be held unless the queue is lock free.
+*/
+HS_Buffer *_TakeBuffer(HS_Queue *Queue)
+{
+    HS_Buffer *Temp = NULL;
+    ULONG RetTail;
+    if(!Queue->Pool) //Pick up the buffers the other side gave back.
+    {
+        RetTail = HS_LoadAcquire(&Queue->RetTail);
+        while(Queue->RetHead != RetTail)
+        {
+            Temp = Queue->Returned[_RingSlot(Queue, Queue->RetHead)];
+            Temp->Next = Queue->Pool;
+            Queue->Pool = Temp;
+            Queue->RetHead = _RingNext(Queue, Queue->RetHead);
+        }
+    }
+    Temp = Queue->Pool;
+    if(!Temp) //Every buffer is in use.
+    {
+        _MarkFull(Queue);
+        return NULL;
+    }
+    if(Queue->FullSince) //Space freed up.
+    {
+        HS_AddOwned64(&Queue->Stats.FullNs, _GetTimeNs() - Queue->FullSince);
+        Queue->FullSince = 0;
+    }
+    Queue->Pool = Temp->Next;
+    Temp->Status = FT_IO_PENDING; //Waiting for read/write call to happen or finish.
+    Temp->BytesTransferred = 0;
+    Temp->Length = Queue->StreamSize;
+    return Temp; //Lent is already FALSE, only the user side writes it.
+}
+
+/*
+    Puts a buffer taken by _TakeBuffer() back without using it. Same rules as _TakeBuffer().
+*/
+void _PutBackBuffer(HS_Queue *Queue, HS_Buffer *Buffer)
+{
+    Buffer->Next = Queue->Pool;
+    Queue->Pool = Buffer;
+}
+
+/*
+    Gives a used buffer back to the pool. Only called by the side that doesn't take buffers.
+    BuffersMutex must be held unless the queue is lock free.
+*/
+void _ReturnBuffer(HS_Queue *Queue, HS_Buffer *Buffer)
+{
+    Queue->Returned[_RingSlot(Queue, Queue->RetTail)] = Buffer; //Can't overflow, it has a slot for every buffer.
+    HS_StoreRelease(&Queue->RetTail, _RingNext(Queue, Queue->RetTail));
+}
+
+/*
+    Returns the lent buffer whose data starts at Data. NULL if Data isn't the start of a lent buffer.
+    BuffersMutex must be held.
+*/
+HS_Buffer *_FindLentBuffer(HS_Queue *Queue, PUCHAR Data)
+{
+    size_t Offset;
+    if((Data < Queue->PoolData) || (Data >= Queue->PoolData + (size_t)Queue->StreamSize * Queue->QueueLength))
+    {
+        return NULL; //Not one of our buffers.
+    }
+    Offset = (size_t)(Data - Queue->PoolData);
+    if(Offset % Queue->StreamSize){return NULL;}
+    if(!Queue->PoolBuffers[Offset / Queue->StreamSize].Lent){return NULL;} //Not held by the user.
+    return &Queue->PoolBuffers[Offset / Queue->StreamSize];
+}
+
+/*
+    Add a buffer to the end of the ring for read/write calls.
+    If WriteBuffer is not null, it is added. Otherwise a buffer is taken from the pool.
+    Called by _QueueRequester (IN) or the user writing (OUT).
+    BuffersMutex must be held unless the queue is lock free.
+*/
+FT_STATUS _AddBuffer(HS_Queue *Queue, HS_Buffer *WriteBuffer)
+{
+    HS_Buffer *NewBuffer = WriteBuffer ? WriteBuffer : _TakeBuffer(Queue);
+    ULONG Count;
+    if(!NewBuffer){return FT_BUSY;} //Queue max length must not be surpassed, user needs to wait until queue gains space.
+    if(Queue->Timed){NewBuffer->QueuedNs = _GetTimeNs();}
+    Queue->Ring[_RingSlot(Queue, Queue->Tail)] = NewBuffer; //Ring can't overflow, it has a slot for every buffer.
+    HS_StoreRelease(&Queue->Tail, _RingNext(Queue, Queue->Tail)); //Publish the buffer.
+    Count = _RingCount(Queue, HS_LoadRelaxed(&Queue->Head), Queue->Tail);
+    if(Count > Queue->Stats.HighWater){HS_StoreRelaxed(&Queue->Stats.HighWater, Count);}
+    return FT_OK;
+}
+
+/*
+    Removes the oldest done buffer from the ring and returns it.
+    Assumes a buffer is done. BuffersMutex must be held unless the queue is lock free.
+*/
+HS_Buffer *_PopBuffer(HS_Queue *Queue)
+{
+    HS_Buffer *Temp = Queue->Ring[_RingSlot(Queue, Queue->Head)]; //Temp is equal to oldest buffer.
+    HS_StoreRelease(&Queue->Head, _RingNext(Queue, Queue->Head));
+    return Temp;
+}
+
+/*
+    Called by _QueueRequester, makes the read/write pipe call for the oldest queued buffer.
+    Assumes a buffer is queued. BuffersMutex must be held unless the queue is lock free.
+*/
+void _PostBuffer(HS_Queue *Queue)
+{
+    HS_Buffer *Temp = Queue->Ring[_RingSlot(Queue, Queue->Post)];
+    if((Queue->Reap == Queue->Post) && HS_LoadRelaxed(&Queue->StallMs)) //Watchdog times the wait from here.
+    {
+        HS_StoreRelaxed64(&Queue->ProgressNs, _GetTimeNs()); //Before Post, the watchdog loads Post first.
+    }
+    if(Queue->Timed)
+    {
+        Temp->PostNs = _GetTimeNs();
+        _RecordLatency(&Queue->Latency[HS_LATENCY_REQUESTER], Temp->PostNs - Temp->QueuedNs);
+    }
+    Temp->Finished = FALSE;
+    if(Queue->PipeID & 0x80) //Make read pipe request.
+    {
+        Temp->Status = D3XX.ReadPipe(Queue->Handle, Queue->PipeID, Temp->Buffer, Temp->Length, &Temp->BytesTransferred, &Temp->Overlap);
+    }
+    else //Make write pipe request.
+    {
+        Temp->Status = D3XX.WritePipe(Queue->Handle, Queue->PipeID, Temp->Buffer, Temp->Length, &Temp->BytesTransferred, &Temp->Overlap);
+    }
+    HS_StoreRelease(&Queue->Post, _RingNext(Queue, Queue->Post));
+}
+
+/*
+    Called by _QueueRequester, aborts the pipe and puts all buffers back into the pool.
+    Overlaps must complete or pipes aborted. Otherwise reusing them is not valid.
+*/
+void _FreeBuffers(HS_Queue *Queue)
+{
+    ULONG i;
+    EnterCriticalSection(&Queue->BuffersMutex);
+    D3XX.AbortPipe(Queue->Handle,Queue->PipeID); //Abort the pipe.
+    Queue->Pool = NULL;
+    for(i = 0; i < Queue->QueueLength; ++i) //Nothing else touches the buffers now, even those lent out.
+    {
+        Queue->PoolBuffers[i].Lent = FALSE;
+        _PutBackBuffer(Queue, &Queue->PoolBuffers[i]);
+    }
+    Queue->Head = 0; Queue->Tail = 0;
+    HS_StoreRelaxed(&Queue->Reap, 0); HS_StoreRelaxed(&Queue->Post, 0); //The watchdog may still be looking.
+    Queue->RetHead = 0; Queue->RetTail = 0;
+    Queue->Recovering = FALSE; //Every buffer is back in the pool.
+    LeaveCriticalSection(&Queue->BuffersMutex);
+    return;
+}
+
+/*
+    Returns the current time of a monotonic clock in nanoseconds.
+*/
+ULONGLONG _GetTimeNs()
+{
+    #ifdef _WIN32
+        LARGE_INTEGER Count, Frequency;
+        QueryPerformanceCounter(&Count);
+        QueryPerformanceFrequency(&Frequency);
+        return (ULONGLONG)((Count.QuadPart / Frequency.QuadPart) * 1000000000ULL +
+                           ((Count.QuadPart % Frequency.QuadPart) * 1000000000ULL) / Frequency.QuadPart);
+    #else
+        struct timespec Now;
+        clock_gettime(CLOCK_MONOTONIC, &Now);
+        return (ULONGLONG)Now.tv_sec * 1000000000ULL + (ULONGLONG)Now.tv_nsec;
+    #endif //_WIN32
+}
+
+/*
+    Returns the deadline for a timeout in milliseconds from Now. INFINITE has no deadline and returns 0.
+*/
+ULONGLONG _GetDeadline(ULONGLONG Now, DWORD Timeout)
+{
+    if(Timeout == INFINITE){return 0;}
+    return Now + (ULONGLONG)Timeout * 1000000ULL;
+}
+
+/*
+    Sleeps on Cond until woken up or the deadline passes. A Deadline of 0 never passes.
+    Returns FALSE without sleeping if the deadline has passed.
+    BuffersMutex must be held, it is held again on return.
+*/
+BOOL _SleepQueue(HS_Queue *Queue, CONDITION_VARIABLE *Cond, ULONGLONG Deadline)
+{
+    ULONGLONG Now;
+    if(!Deadline)
+    {
+        SleepConditionVariableCS(Cond, &Queue->BuffersMutex, INFINITE);
+        return TRUE;
+    }
+    Now = _GetTimeNs();
+    if(Now >= Deadline){return FALSE;}
+    SleepConditionVariableCS(Cond, &Queue->BuffersMutex, (DWORD)((Deadline - Now + 999999ULL) / 1000000ULL));
+    return TRUE;
+}
+
+/*
+    Wakes every HS_WaitAny() call waiting on the queue. BuffersMutex must be held.
+    Taking a waiter's Mutex means it either hasn't checked the queues yet or is asleep.
+*/
+void _WakeWaiters(HS_Queue *Queue)
+{
+    HS_WaitNode *Node;
+    for(Node = Queue->Waiters; Node; Node = Node->Next)
+    {
+        EnterCriticalSection(&Node->Waiter->Mutex);
+        WakeConditionVariable(&Node->Waiter->Cond);
+        LeaveCriticalSection(&Node->Waiter->Mutex);
+    }
+}
+
+/*
+    Wakes user calls sleeping on the queue.
+    BuffersMutex must be held unless the queue is lock free, then it's only taken if someone sleeps.
+*/
+void _WakeUser(HS_Queue *Queue)
+{
+    if(!Queue->LockFree)
+    {
+        WakeAllConditionVariable(&Queue->UserCond);
+        if(Queue->Waiters){_WakeWaiters(Queue);}
+        return;
+    }
+    HS_Fence(); //Our index must be seen before we check for sleepers, _WaitUser() and HS_WaitAny() do the opposite.
+    if(!HS_LoadRelaxed(&Queue->UserWaiting) && !HS_LoadRelaxed(&Queue->AnyWaiting)){return;}
+    EnterCriticalSection(&Queue->BuffersMutex);
+    WakeAllConditionVariable(&Queue->UserCond);
+    _WakeWaiters(Queue);
+    LeaveCriticalSection(&Queue->BuffersMutex);
+}
+
+/*
+    Wakes _QueueRequester if it is sleeping. Same rules as _WakeUser().
+*/
+void _WakeRequester(HS_Queue *Queue)
+{
+    HS_Reactor *Reactor = Queue->Reactor;
+    if(Reactor) //The reactor sleeps on its own condition variable.
+    {
+        HS_FetchAdd(&Reactor->Kicks, 1);
+        HS_Fence();
+        if(!HS_LoadRelaxed(&Reactor->Waiting)){return;}
+        EnterCriticalSection(&Reactor->SleepMutex);
+        WakeConditionVariable(&Reactor->Cond);
+        LeaveCriticalSection(&Reactor->SleepMutex);
+        return;
+    }
+    if(!Queue->LockFree){WakeConditionVariable(&Queue->RequesterCond); return;}
+    HS_Fence();
+    if(!HS_LoadRelaxed(&Queue->RequesterWaiting)){return;}
+    EnterCriticalSection(&Queue->BuffersMutex);
+    WakeConditionVariable(&Queue->RequesterCond);
+    LeaveCriticalSection(&Queue->BuffersMutex);
+}
+
+/*
+    Waits up to Timeout milliseconds for Ready(Queue) to be true. A Timeout of 0 doesn't wait.
+    BuffersMutex must be held unless the queue is lock free, then it's only taken to sleep.
+    Returns the last result of Ready(Queue).
+*/
+BOOL _WaitUser(HS_Queue *Queue, BOOL (*Ready)(HS_Queue *), DWORD Timeout)
+{
+    ULONGLONG Start, Deadline;
+    BOOL Result = Ready(Queue);
+    if(Result || !Timeout){return Result;} //Fast path, no clock or lock needed.
+    Start = _GetTimeNs();
+    Deadline = _GetDeadline(Start, Timeout);
+    if(Queue->LockFree)
+    {
+        EnterCriticalSection(&Queue->BuffersMutex);
+        HS_FetchAdd(&Queue->UserWaiting, 1); //Tell _WakeUser() to take the lock.
+        HS_Fence();
+    }
+    while(!(Result = Ready(Queue)) && HS_LoadAcquire(&Queue->Active) && _SleepQueue(Queue, &Queue->UserCond, Deadline));
+    if(Queue->LockFree)
+    {
+        HS_FetchAdd(&Queue->UserWaiting, (ULONG)-1);
+        LeaveCriticalSection(&Queue->BuffersMutex);
+    }
+    HS_AddRelaxed64(&Queue->Stats.WaitNs, _GetTimeNs() - Start); //Readers and writers of an OUT queue can both wait.
+    return Result;
+}
+
+/*
+    _WaitUser() conditions.
+*/
+BOOL _ReadReady(HS_Queue *Queue){return Queue->Head != HS_LoadAcquire(&Queue->Reap);} //A buffer is done.
+BOOL _PoolReady(HS_Queue *Queue){return Queue->Pool || (Queue->RetHead != HS_LoadAcquire(&Queue->RetTail));} //A buffer is free.
+BOOL _StatusReady(HS_Queue *Queue) //A write is done or none are queued.
+{
+    return (Queue->Head != HS_LoadAcquire(&Queue->Reap)) || (Queue->Head == HS_LoadAcquire(&Queue->Tail));
+}
+
+/*
+    Called by _QueueRequester when it has nothing to do. Sleeps until a user call or HS_DestroyQueue() wakes it.
+    BuffersMutex must be held unless the queue is lock free.
+*/
+void _WaitRequester(HS_Queue *Queue)
+{
+    BOOL Ready;
+    if(!Queue->LockFree){SleepConditionVariableCS(&Queue->RequesterCond, &Queue->BuffersMutex, INFINITE); return;}
+    EnterCriticalSection(&Queue->BuffersMutex);
+    HS_FetchAdd(&Queue->RequesterWaiting, 1); //Tell _WakeRequester() to take the lock.
+    HS_Fence();
+    Ready = !HS_LoadAcquire(&Queue->Paused) && (Queue->Post != HS_LoadAcquire(&Queue->Tail)); //Resumed or a buffer was added.
+    if((Queue->PipeID & 0x80) && !Queue->Stopped && _PoolReady(Queue) &&
+       (_RingCount(Queue, HS_LoadAcquire(&Queue->Head), Queue->Tail) < Queue->QueueLength))
+    {
+        Ready = TRUE; //HS_ReleaseReadBuffer() gave back a buffer.
+    }
+    if(HS_LoadAcquire(&Queue->AbortWanted)){Ready = TRUE;} //HS_PauseQueue() waits on us.
+    if(!Ready && HS_LoadAcquire(&Queue->Active))
+    {
+        SleepConditionVariableCS(&Queue->RequesterCond, &Queue->BuffersMutex, INFINITE);
+    }
+    HS_FetchAdd(&Queue->RequesterWaiting, (ULONG)-1);
+    LeaveCriticalSection(&Queue->BuffersMutex);
+}
+
+/*
+    Makes the queue's eventfd readable if the user asked for one. Called after a read/write is marked done.
+*/
+void _SignalEventFd(HS_Queue *Queue)
+{
+    #ifndef _WIN32
+        ULONGLONG One = 1;
+        int Fd = HS_LoadAcquire(&Queue->EventFd);
+        if(Fd >= 0){if(write(Fd, &One, sizeof(One)) < 0){}} //Only fails if the counter is full, it's readable then.
+    #endif //_WIN32
+}
+
+/*
+    Called by _QueueRequester of a callback queue, hands the oldest done read to the callback and reuses its buffer.
+    BuffersMutex must be held unless the queue is lock free, it's released while the callback runs.
+*/
+void _RunCallback(HS_Queue *Queue)
+{
+    HS_Buffer *TempBuffer = NULL;
+    if(!HS_LoadAcquire(&Queue->Active)){return;} //Being destroyed, the read was likely aborted. _FreeBuffers() cleans up.
+    TempBuffer = _PopBuffer(Queue); //We're the user of the ring, Head is ours.
+    if(TempBuffer->Status != FT_OK){Queue->Stopped = TRUE;} //Stop reading, the queue must be destroyed.
+    if(Queue->Timed){_RecordLatency(&Queue->Latency[HS_LATENCY_USER], _GetTimeNs() - TempBuffer->DoneNs);}
+    if(!Queue->LockFree){LeaveCriticalSection(&Queue->BuffersMutex);}
+    Queue->Callback(Queue->CallbackContext, TempBuffer->Buffer, TempBuffer->BytesTransferred, TempBuffer->Status);
+    if(!Queue->LockFree){EnterCriticalSection(&Queue->BuffersMutex);}
+    _PutBackBuffer(Queue, TempBuffer); //We also take buffers for IN queues, straight back to the pool.
+}
+
+/*
+    Gets the results of the transfers in flight after _RecoverPipe() aborted the pipe. Without Wait, returns FALSE
+    while some haven't finished, a reactor calls again on its next sweeps instead of holding up the handle's other queues.
+    Once all are in, transfers that finished OK stay at Reap in order and are handed out as usual, the failed ones
+    move behind them to be posted again. BuffersMutex must be held unless the queue is lock free, it's released while waiting.
+*/
+BOOL _FinishRecovery(HS_Queue *Queue, BOOL Wait)
+{
+    ULONG Index, Kept, Move;
+    BOOL Done = TRUE;
+    FT_STATUS Status;
+    HS_Buffer *TempBuffer = NULL;
+    if(Wait && !Queue->LockFree){LeaveCriticalSection(&Queue->BuffersMutex);}
+    for(Index = Queue->Reap; Index != Queue->Post; Index = _RingNext(Queue, Index))
+    {
+        TempBuffer = Queue->Ring[_RingSlot(Queue, Index)]; //Reap to Post is only touched by us.
+        if(TempBuffer->Finished){continue;} //Result is in.
+        if((TempBuffer->Status == FT_IO_PENDING) || (TempBuffer->Status == FT_OK))
+        {
+            Status = D3XX.GetOverlappedResult(Queue->Handle, &TempBuffer->Overlap, &TempBuffer->BytesTransferred, Wait);
+            if(Status == FT_IO_INCOMPLETE){Done = FALSE; continue;}
+            TempBuffer->Status = Status;
+        }
+        TempBuffer->Finished = TRUE;
+    }
+    if(Wait && !Queue->LockFree){EnterCriticalSection(&Queue->BuffersMutex);}
+    if(!Done){return FALSE;}
+    Kept = Queue->Reap; //Ring index the next transfer that finished OK moves to.
+    for(Index = Queue->Reap; Index != Queue->Post; Index = _RingNext(Queue, Index))
+    {
+        TempBuffer = Queue->Ring[_RingSlot(Queue, Index)];
+        if(TempBuffer->Status != FT_OK){TempBuffer->Finished = FALSE; continue;} //Posted again.
+        for(Move = Index; Move != Kept; Move = _RingPrev(Queue, Move)) //Keeps the order of both.
+        {
+            Queue->Ring[_RingSlot(Queue, Move)] = Queue->Ring[_RingSlot(Queue, _RingPrev(Queue, Move))];
+        }
+        Queue->Ring[_RingSlot(Queue, Kept)] = TempBuffer;
+        Kept = _RingNext(Queue, Kept);
+    }
+    Queue->Recovering = FALSE;
+    HS_StoreRelaxed(&Queue->Stalled, FALSE);
+    HS_StoreRelaxed64(&Queue->ProgressNs, _GetTimeNs());
+    HS_StoreRelease(&Queue->Post, Kept); //Nothing in flight, the failed ones are posted next.
+    return TRUE;
+}
+
+/*
+    Called when the transfer at Reap failed with Status, or with FT_IO_PENDING to end every transfer in flight.
+    Aborts the pipe and gets the results of the rest in flight, see _FinishRecovery(). Bumps Counter if it isn't NULL.
+*/
+BOOL _RecoverPipe(HS_Queue *Queue, FT_STATUS Status, ULONGLONG *Counter, BOOL Wait)
+{
+    HS_Buffer *TempBuffer = Queue->Ring[_RingSlot(Queue, Queue->Reap)];
+    if(Status != FT_IO_PENDING){TempBuffer->Status = Status; TempBuffer->Finished = TRUE;}
+    D3XX.AbortPipe(Queue->Handle, Queue->PipeID); //A pipe timeout only ends one transfer, end the rest too.
+    Queue->Recovering = TRUE;
+    if(Counter){HS_AddOwned64(Counter, 1);}
+    return _FinishRecovery(Queue, Wait);
+}
+
+/*
+    Called by _QueueRequester or a reactor, gets the oldest posted buffer's overlap and marks it done.
+    If Wait is false, returns FALSE without marking it done if the overlap hasn't completed or a recovery is waiting on others.
+    Assumes a buffer is in flight. BuffersMutex must be held unless the queue is lock free.
+    BuffersMutex is released while waiting on the overlap.
+*/
+BOOL _ReapBuffer(HS_Queue *Queue, BOOL Wait)
+{
+    HS_Buffer *TempBuffer = Queue->Ring[_RingSlot(Queue, Queue->Reap)];
+    FT_STATUS Status = TempBuffer->Status;
+    BOOL Kept;
+    if(Queue->Recovering){return _FinishRecovery(Queue, Wait);} //Buffers can't be handed out until it's done.
+    Kept = TempBuffer->Finished; //Kept by _FinishRecovery(), Status has its result.
+    if(Kept){TempBuffer->Finished = FALSE;}
+    else if((Status == FT_IO_PENDING) || (Status == FT_OK)) //Only wait on overlaps of calls that didn't fail.
+    {
+        if(Wait && !Queue->LockFree){LeaveCriticalSection(&Queue->BuffersMutex);}
+        Status = D3XX.GetOverlappedResult(Queue->Handle, &TempBuffer->Overlap, &TempBuffer->BytesTransferred, Wait);
+        if(Wait && !Queue->LockFree){EnterCriticalSection(&Queue->BuffersMutex);}
+    }
+    if(!Wait && (Status == FT_IO_INCOMPLETE)){return FALSE;} //Still in flight.
+    if((Status != FT_OK) && HS_LoadAcquire(&Queue->Paused))
+    {
+        return _RecoverPipe(Queue, Status, NULL, Wait); //Likely aborted by HS_PauseQueue(), post it again on resume.
+    }
+    if((Status != FT_OK) && (Queue->Retries < HS_RECOVER_TRIES)) //Keeps a dead pipe from looping.
+    {
+        if(HS_LoadAcquire(&Queue->Stalled) || ((Status == FT_TIMEOUT) && //Only timeouts the user asked for.
+           (HS_LoadRelaxed(&Queue->PipeTimeoutMs) || HS_LoadRelaxed(&Queue->StallMs))))
+        {
+            Queue->Retries += 1;
+            return _RecoverPipe(Queue, Status, &Queue->Stats.Stalls, Wait); //Stalled, post it again instead of handing the failure out.
+        }
+        if(Queue->Recover)
+        {
+            Queue->Retries += 1;
+            HS_AddOwned64(&Queue->Stats.FailedTransfers, 1);
+            HS_StoreRelaxed(&Queue->Stats.LastError, Status);
+            return _RecoverPipe(Queue, Status, &Queue->Stats.Recoveries, Wait);
+        }
+    }
+    if((Status == FT_OK) && !Kept){Queue->Retries = 0;} //Kept ones finished before the recovery.
+    if(HS_LoadRelaxed(&Queue->Stalled)){HS_StoreRelaxed(&Queue->Stalled, FALSE);} //The watchdog's abort missed, don't recover the next failure.
+    if(HS_LoadRelaxed(&Queue->StallMs)){HS_StoreRelaxed64(&Queue->ProgressNs, _GetTimeNs());}
+    TempBuffer->Status = Status;
+    if(Queue->Timed)
+    {
+        TempBuffer->DoneNs = _GetTimeNs();
+        _RecordLatency(&Queue->Latency[HS_LATENCY_DEVICE], TempBuffer->DoneNs - TempBuffer->PostNs);
+    }
+    if(Status == FT_OK)
+    {
+        HS_AddOwned64(&Queue->Stats.Transfers, 1);
+        HS_AddOwned64(&Queue->Stats.Bytes, TempBuffer->BytesTransferred);
+        if(TempBuffer->BytesTransferred < TempBuffer->Length){HS_AddOwned64(&Queue->Stats.ShortTransfers, 1);}
+    }
+    else{HS_AddOwned64(&Queue->Stats.FailedTransfers, 1);}
+    HS_StoreRelease(&Queue->Reap, _RingNext(Queue, Queue->Reap)); //Hand the buffer to the user.
+    if(Queue->Callback){_RunCallback(Queue);}
+    else
+    {
+        _WakeUser(Queue); //Tell any waiting user calls the buffer is done.
+        _SignalEventFd(Queue);
+    }
+    return TRUE;
+}
+
+/*
+    Called by _QueueRequester or a reactor for HS_PauseQueue() with HS_PAUSE_ABORT. Nothing is posted while paused,
+    so aborting now gets every transfer in flight. Aborted ones go back to being queued.
+    Without Wait, returns FALSE while transfers are still in flight, a reactor calls again on its next sweeps.
+    BuffersMutex must be held unless the queue is lock free.
+*/
+BOOL _AbortInFlight(HS_Queue *Queue, BOOL Wait)
+{
+    if(!Queue->Recovering && (Queue->Reap != Queue->Post) && !_RecoverPipe(Queue, FT_IO_PENDING, NULL, Wait)){return FALSE;}
+    while(Queue->Reap != Queue->Post){if(!_ReapBuffer(Queue, Wait)){return FALSE;}} //Hands out the ones kept.
+    HS_StoreRelease(&Queue->AbortWanted, FALSE);
+    _WakeUser(Queue); //HS_PauseQueue() is waiting.
+    return TRUE;
+}
+
+/*
+    Makes read/write pipe requests and fills the queue.
+    Waits for the results of the requests in the order they were made.
+    Sleeps on RequesterCond while the queue is full (IN) or has nothing to write (OUT) and nothing is in flight.
+    Lock free queues only take BuffersMutex to sleep.
+*/
+FT_STATUS _QueueRequester(HS_Queue *Queue)
+{
+    BOOL InPipe = Queue->PipeID & 0x80; //If true, we make read pipe requests.
+    if(!Queue->LockFree){EnterCriticalSection(&Queue->BuffersMutex);}
+    while(HS_LoadAcquire(&Queue->Active)) //Main thread tells us to stop by clearing Active.
+    {
+        if(InPipe && !Queue->Stopped){_AddBuffer(Queue, NULL);} //Add a buffer to read into if the queue isn't full.
+        if(_CanPost(Queue)){_PostBuffer(Queue); continue;} //Make read/write pipe requests first.
+        if(HS_LoadAcquire(&Queue->AbortWanted)){_AbortInFlight(Queue, TRUE); continue;} //Paused, Post can't move now.
+        if(Queue->Reap != Queue->Post){_ReapBuffer(Queue, TRUE); continue;} //Get the oldest read/write in flight.
+        _WaitRequester(Queue); //Wait for HS_ReadQueue() to free a buffer or HS_WriteQueue() to add data.
+    }
+    if(!Queue->LockFree){LeaveCriticalSection(&Queue->BuffersMutex);}
+    _FreeBuffers(Queue); //Clear out the buffer!
+    return FT_OK; //Stop running.
+}
+
+/*
+    Starts a thread running Function(Argument). Returns NULL on failure.
+*/
+HANDLE _StartThread(PVOID Function, PVOID Argument, DWORD *ThreadID)
+{
+    HANDLE ThreadHandle = NULL;
+    #ifdef _WIN32
+        ThreadHandle = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)Function, Argument, 0, ThreadID);
+    #else
+        ThreadHandle = (HANDLE) malloc(sizeof(pthread_t));
+        if(ThreadHandle)
+        {
+            if(pthread_create(ThreadHandle, NULL, (PVOID)Function, Argument))
+            {free(ThreadHandle); ThreadHandle = NULL;} //Failed to create thread.
+        }
+    #endif //_WIN32
+    return ThreadHandle;
+}
+
+/*
+    Waits for a thread from _StartThread() to stop and frees it.
+*/
+void _JoinThread(HANDLE ThreadHandle)
+{
+    #ifdef _WIN32
+        WaitForSingleObject(ThreadHandle, INFINITE); //Wait for thread to stop.
+        CloseHandle(ThreadHandle); //Close the thread to free up resources.
+    #else
+        pthread_join(*((pthread_t *)ThreadHandle), NULL);
+        free(ThreadHandle);
+    #endif //_WIN32
+}
+
+/*
+    Called by a reactor, posts everything it can for a queue and marks every finished overlap done.
+    Sets *InFlight if the queue still has posted buffers. Returns TRUE if anything was done.
+*/
+BOOL _ServiceQueue(HS_Queue *Queue, BOOL *InFlight)
+{
+    BOOL Progress = FALSE;
+    if(!Queue->LockFree){EnterCriticalSection(&Queue->BuffersMutex);}
+    if(Queue->PipeID & 0x80){while(_AddBuffer(Queue, NULL) == FT_OK);} //Read into every free buffer.
+    while(_CanPost(Queue)){_PostBuffer(Queue); Progress = TRUE;}
+    if(HS_LoadAcquire(&Queue->AbortWanted) && _AbortInFlight(Queue, FALSE)){Progress = TRUE;}
+    while((Queue->Reap != Queue->Post) && _ReapBuffer(Queue, FALSE)){Progress = TRUE;} //Results in the order of the requests.
+    if(Queue->Reap != Queue->Post){*InFlight = TRUE;}
+    if(!Queue->LockFree){LeaveCriticalSection(&Queue->BuffersMutex);}
+    return Progress;
+}
+
+/*
+    Called by a reactor when a sweep did nothing. Sleeps until _WakeRequester() is called since Kicks was read.
+    While transfers are in flight, overlaps can't wake us, so yield for a while and then poll every HS_REACTOR_SLEEP_MS.
+*/
+void _ReactorWait(HS_Reactor *Reactor, ULONG Kicks, BOOL InFlight, ULONG *Idle)
+{
+    if(InFlight && (++(*Idle) < HS_REACTOR_SPINS)){SwitchToThread(); return;}
+    EnterCriticalSection(&Reactor->SleepMutex);
+    HS_FetchAdd(&Reactor->Waiting, 1); //Tell _WakeRequester() to take the lock.
+    HS_Fence();
+    if(HS_LoadAcquire(&Reactor->Active) && (HS_LoadAcquire(&Reactor->Kicks) == Kicks))
+    {
+        SleepConditionVariableCS(&Reactor->Cond, &Reactor->SleepMutex, InFlight ? HS_REACTOR_SLEEP_MS : INFINITE);
+    }
+    HS_FetchAdd(&Reactor->Waiting, (ULONG)-1);
+    LeaveCriticalSection(&Reactor->SleepMutex);
+}
+
+/*
+    Does the work of _QueueRequester for every queue of a reactor from one thread.
+    Finished overlaps are handed to their queues in the order the sweeps find them.
+*/
+FT_STATUS _ReactorThread(HS_Reactor *Reactor)
+{
+    ULONG i, Kicks, Idle = 0;
+    BOOL Progress, InFlight;
+    while(HS_LoadAcquire(&Reactor->Active))
+    {
+        Kicks = HS_LoadAcquire(&Reactor->Kicks);
+        Progress = FALSE; InFlight = FALSE;
+        EnterCriticalSection(&Reactor->ListMutex);
+        for(i = 0; i < Reactor->QueueCount; ++i)
+        {
+            if(_ServiceQueue(Reactor->Queues[i], &InFlight)){Progress = TRUE;}
+        }
+        LeaveCriticalSection(&Reactor->ListMutex);
+        if(Progress){Idle = 0; continue;}
+        _ReactorWait(Reactor, Kicks, InFlight, &Idle);
+    }
+    return FT_OK;
+}
+
+/*
+    Adds a queue to the reactor of its handle, starting one if the handle has none.
+*/
+FT_STATUS _AttachReactor(HS_Queue *Queue)
+{
+    HS_Device *Device = Queue->Device;
+    HS_Reactor *Reactor = NULL;
+    EnterCriticalSection(&Device->ReactorMutex);
+    Reactor = Device->Reactor;
+    if(!Reactor)
+    {
+        Reactor = malloc(sizeof(HS_Reactor));
+        if(!Reactor){LeaveCriticalSection(&Device->ReactorMutex); return FT_NO_SYSTEM_RESOURCES;}
+        Reactor->QueueCount = 0;
+        Reactor->Active = TRUE;
+        Reactor->Kicks = 0; Reactor->Waiting = 0;
+        InitializeCriticalSection(&Reactor->ListMutex);
+        InitializeCriticalSection(&Reactor->SleepMutex);
+        InitializeConditionVariable(&Reactor->Cond);
+        Reactor->ThreadHandle = _StartThread((PVOID)_ReactorThread, Reactor, &Reactor->ThreadID);
+        if(!Reactor->ThreadHandle)
+        {
+            DeleteCriticalSection(&Reactor->ListMutex);
+            DeleteCriticalSection(&Reactor->SleepMutex);
+            DeleteConditionVariable(&Reactor->Cond);
+            free(Reactor);
+            LeaveCriticalSection(&Device->ReactorMutex);
+            return FT_NO_SYSTEM_RESOURCES;
+        }
+        Device->Reactor = Reactor;
+    }
+    EnterCriticalSection(&Reactor->ListMutex); //Can't be full, the handle has one queue per pipe.
+    Reactor->Queues[Reactor->QueueCount++] = Queue;
+    EnterCriticalSection(&Queue->BuffersMutex); //User calls wake Reactor under it.
+    Queue->Reactor = Reactor;
+    LeaveCriticalSection(&Queue->BuffersMutex);
+    LeaveCriticalSection(&Reactor->ListMutex);
+    LeaveCriticalSection(&Device->ReactorMutex);
+    _WakeRequester(Queue); //Start reading.
+    return FT_OK;
+}
+
+/*
+    Takes a queue off its reactor, the reactor won't touch it after this returns.
+    Stops the reactor's thread if it was the last queue, only the handle's ReactorMutex is held while it's joined.
+*/
+void _DetachReactor(HS_Queue *Queue)
+{
+    ULONG i;
+    HS_Device *Device = Queue->Device;
+    HS_Reactor *Reactor = Queue->Reactor;
+    EnterCriticalSection(&Device->ReactorMutex);
+    EnterCriticalSection(&Reactor->ListMutex); //Waits for the current sweep to finish.
+    for(i = 0; i < Reactor->QueueCount; ++i)
+    {
+        if(Reactor->Queues[i] == Queue){Reactor->Queues[i] = Reactor->Queues[--Reactor->QueueCount]; break;}
+    }
+    LeaveCriticalSection(&Reactor->ListMutex);
+    if(Reactor->QueueCount){LeaveCriticalSection(&Device->ReactorMutex); return;}
+    Device->Reactor = NULL; //The next reactor queue of the handle starts a new one.
+    LeaveCriticalSection(&Device->ReactorMutex);
+    EnterCriticalSection(&Reactor->SleepMutex);
+    HS_StoreRelease(&Reactor->Active, FALSE); //Tell thread to stop.
+    WakeConditionVariable(&Reactor->Cond);
+    LeaveCriticalSection(&Reactor->SleepMutex);
+    _JoinThread(Reactor->ThreadHandle);
+    DeleteCriticalSection(&Reactor->ListMutex);
+    DeleteCriticalSection(&Reactor->SleepMutex);
+    DeleteConditionVariable(&Reactor->Cond);
+    free(Reactor);
+}
+
+/*
+    Called by the watchdog for every queue. Returns TRUE if the queue's pipe must be aborted because nothing in flight
+    finished for StallMs, at most once per StallMs. Lowers *Tick to how long the watchdog can sleep before the queue
+    needs another look. QueueListMutex must be held.
+*/
+BOOL _CheckStall(HS_Queue *Queue, ULONGLONG Now, DWORD *Tick)
+{
+    ULONG StallMs = HS_LoadRelaxed(&Queue->StallMs);
+    ULONGLONG Since;
+    if(!StallMs || Queue->Closing || !HS_LoadAcquire(&Queue->Active)){return FALSE;} //Closing ones are being stopped.
+    if((StallMs / HS_WATCHDOG_CHECKS) < *Tick){*Tick = (StallMs < HS_WATCHDOG_CHECKS) ? 1 : (StallMs / HS_WATCHDOG_CHECKS);}
+    if(HS_LoadAcquire(&Queue->Post) == HS_LoadAcquire(&Queue->Reap)){return FALSE;} //Nothing in flight to stall.
+    Since = HS_LoadRelaxed64(&Queue->ProgressNs);
+    if(Queue->AbortNs > Since){Since = Queue->AbortNs;} //Give the last abort time to be recovered.
+    if(Now < Since + (ULONGLONG)StallMs * 1000000ULL){return FALSE;}
+    Queue->AbortNs = Now;
+    HS_StoreRelease(&Queue->Stalled, TRUE); //Before the abort, so _ReapBuffer() recovers what it fails.
+    return TRUE;
+}
+
+/*
+    Waits for the watchdog to finish aborting the queue's pipe. QueueListMutex must be held and Closing set,
+    so the watchdog won't pick the queue again.
+*/
+void _WaitStallAbort(HS_Queue *Queue)
+{
+    while(Queue->StallAbort){SleepConditionVariableCS(&StallAbortCond, &QueueListMutex, INFINITE);}
+}
+
+/*
+    Checks every queue with a StallMs for stalls until _StopWatchdog(). Sleeps while no queue has one.
+    Stalled pipes are aborted after each sweep without QueueListMutex, a slow abort doesn't hold up other handles.
+    StallAbort keeps HS_DestroyQueue() and HS_ReattachDevice() off those queues meanwhile.
+*/
+FT_STATUS _WatchdogThread(PVOID Unused)
+{
+    ULONG i, j;
+    DWORD Tick;
+    ULONGLONG Now;
+    HS_Device *Device = NULL;
+    HS_Queue *Stalls, *Queue;
+    EnterCriticalSection(&QueueListMutex);
+    while(WatchdogActive)
+    {
+        Tick = INFINITE;
+        Now = _GetTimeNs();
+        Stalls = NULL;
+        for(i = 0; i < HS_DEVICE_BUCKETS; ++i)
+        {
+            for(Device = DeviceTable[i]; Device; Device = Device->Next)
+            {
+                for(j = 0; j < HS_DEVICE_PIPES; ++j)
+                {
+                    Queue = Device->Queues[j];
+                    if(!Queue || !_CheckStall(Queue, Now, &Tick)){continue;}
+                    Queue->StallAbort = TRUE;
+                    Queue->NextStall = Stalls;
+                    Stalls = Queue;
+                }
+            }
+        }
+        if(Stalls)
+        {
+            LeaveCriticalSection(&QueueListMutex);
+            for(Queue = Stalls; Queue; Queue = Queue->NextStall){D3XX.AbortPipe(Queue->Handle, Queue->PipeID);}
+            EnterCriticalSection(&QueueListMutex);
+            for(Queue = Stalls; Queue; Queue = Queue->NextStall){Queue->StallAbort = FALSE;} //Waiters need the lock to look.
+            WakeAllConditionVariable(&StallAbortCond);
+        }
+        SleepConditionVariableCS(&WatchdogCond, &QueueListMutex, Tick);
+    }
+    LeaveCriticalSection(&QueueListMutex);
+    return FT_OK;
+}
+
+/*
+    Stops the watchdog if it was started.
+*/
+void _StopWatchdog()
+{
+    HANDLE ThreadHandle = NULL;
+    EnterCriticalSection(&QueueListMutex);
+    ThreadHandle = WatchdogThread;
+    WatchdogThread = NULL;
+    WatchdogActive = FALSE; //Tell thread to stop.
+    WakeConditionVariable(&WatchdogCond);
+    LeaveCriticalSection(&QueueListMutex);
+    if(ThreadHandle){_JoinThread(ThreadHandle);}
+}
+
+/*
+    Creates the thread for the queue, or hands the queue to its handle's reactor for HS_QUEUE_REACTOR.
+    BuffersMutex and the condition variables live as long as the queue, they're made by AddQueue().
+*/
+FT_STATUS _CreateThread(HS_Queue *Queue, BOOL UseReactor)
+{
+    FT_STATUS Status = FT_OK;
+    if(!Queue){return FT_INVALID_PARAMETER;}
+    EnterCriticalSection(&Queue->BuffersMutex); //User calls left from before a reattach may be looking.
+    HS_StoreRelease(&Queue->Active, TRUE); //Indicate Queue is active.
+    LeaveCriticalSection(&Queue->BuffersMutex);
+    if(UseReactor){Status = _AttachReactor(Queue);}
+    else
+    {
+        Queue->ThreadHandle = _StartThread((PVOID)_QueueRequester, Queue, &Queue->ThreadID);
+        if(!Queue->ThreadHandle){Status = FT_NO_SYSTEM_RESOURCES;} //If we failed to make a thread.
+    }
+    if(Status != FT_OK)
+    {
+        EnterCriticalSection(&Queue->BuffersMutex);
+        HS_StoreRelease(&Queue->Active, FALSE);
+        LeaveCriticalSection(&Queue->BuffersMutex);
+    }
+    return Status;
+}
+
+/*
+    Stops the queue's thread, or takes it off its reactor, and puts every buffer back in its pool.
+    Undoes _CreateThread(), does nothing if the queue isn't active. User calls still running on the queue can keep
+    using BuffersMutex and the condition variables, only HS_DestroyQueue() deletes them.
+*/
+void _StopQueue(HS_Queue *Queue)
+{
+    if(!Queue->Active){return;}
+    EnterCriticalSection(&Queue->BuffersMutex);
+    HS_StoreRelease(&Queue->Active, FALSE); //Tell thread to stop.
+    WakeConditionVariable(&Queue->RequesterCond); //Thread may be sleeping.
+    WakeAllConditionVariable(&Queue->UserCond);
+    LeaveCriticalSection(&Queue->BuffersMutex);
+    if(Queue->Reactor) //The reactor's thread keeps running for the handle's other queues.
+    {
+        _DetachReactor(Queue);
+        _FreeBuffers(Queue);
+        EnterCriticalSection(&Queue->BuffersMutex);
+        Queue->Reactor = NULL;
+        LeaveCriticalSection(&Queue->BuffersMutex);
+    }
+    else
+    {
+        D3XX.AbortPipe(Queue->Handle, Queue->PipeID); //Thread may be waiting on an overlap.
+        _JoinThread(Queue->ThreadHandle); //Wait for thread to stop, it frees the buffers on its way out.
+        Queue->ThreadHandle = NULL;
+    }
+}
+
+/*
+    Moves a stopped queue to NewHandle and starts it again with the same pool, making the overlaps again for NewHandle.
+    A queue that can't be started is left detached whatever step failed: stopped, overlaps released and Handle NULL.
+    It keeps its pool and its place in a pipe table, so user calls on it stay safe and HS_DestroyQueue() frees it.
+    A later reattach of the handle it's on starts it again.
+*/
+FT_STATUS _RestartQueue(HS_Queue *Queue, FT_HANDLE NewHandle)
+{
+    ULONG i;
+    FT_STATUS Status = FT_OK;
+    HS_Device *OldDevice = Queue->Device;
+    if(Queue->Handle){_DetachQueue(Queue, Queue->QueueLength);} //Before the old handle is closed.
+    EnterCriticalSection(&QueueListMutex);
+    Queue->Handle = NewHandle;
+    Status = _ClaimPipe(Queue); //Only sets Device on success.
+    if(Status == FT_OK){_ReleasePipe(OldDevice, Queue->PipeID);}
+    else{Queue->Handle = NULL;} //Stays in the old pipe table.
+    LeaveCriticalSection(&QueueListMutex);
+    if(Status != FT_OK){return Status;}
+    for(i = 0; i < Queue->QueueLength; ++i)
+    {
+        if(D3XX.InitializeOverlapped(NewHandle, &Queue->PoolBuffers[i].Overlap) != FT_OK)
+        {
+            _DetachQueue(Queue, i);
+            return FT_NO_SYSTEM_RESOURCES;
+        }
+    }
+    if(Queue->Flags & HS_QUEUE_FIXED){Status = D3XX.SetStreamPipe(NewHandle, FALSE, FALSE, Queue->PipeID, Queue->StreamSize);}
+    else{Status = D3XX.ClearStreamPipe(NewHandle, FALSE, FALSE, Queue->PipeID);}
+    if((Status == FT_OK) && Queue->PipeTimeoutMs)
+    {
+        Status = D3XX.SetPipeTimeout(NewHandle, Queue->PipeID, Queue->PipeTimeoutMs); //Only stored if the backend has it.
+    }
+    if(Status == FT_OK)
+    {
+        Queue->Stopped = FALSE; Queue->Stalled = FALSE; Queue->Retries = 0; Queue->AbortWanted = FALSE;
+        HS_StoreRelaxed64(&Queue->ProgressNs, _GetTimeNs()); //The watchdog doesn't count the time it was detached.
+        Status = _CreateThread(Queue, (Queue->Flags & HS_QUEUE_REACTOR) ? TRUE : FALSE);
+    }
+    if(Status != FT_OK){_DetachQueue(Queue, Queue->QueueLength);}
+    return Status;
+}
+
+//Returns version of the QueueD3XX library in hex. 0xAABBCCDD = Version AA.BB.CC.DD.
+ULONG HS_GetVersionQueueD3XX(){return (ULONG)QUEUE_D3XX_VERSION;}
+
+/*
+    Add a new Queue to the Queue list.
+*/
+FT_STATUS AddQueue(FT_HANDLE Handle, UCHAR PipeID, ULONG StreamSize,ULONG QueueLength, ULONG Flags,
+                   HS_READ_CALLBACK Callback, PVOID Context, PVOID NewQueueP)
+{
+    FT_STATUS Status;
+    if((StreamSize < 1) || (QueueLength < 1) || (!NewQueueP)){return FT_INVALID_PARAMETER;}
+    if(_PipeIndex(PipeID) == HS_DEVICE_PIPES){return FT_INVALID_PARAMETER;} //Not a pipe of a FT60x.
+    HS_Queue *NewQueue = malloc(sizeof(HS_Queue));
+    if(!NewQueue){return FT_NO_SYSTEM_RESOURCES;}
+    NewQueue->Handle = Handle;
+    NewQueue->PipeID = PipeID;
+    NewQueue->StreamSize = StreamSize;
+    NewQueue->QueueLength = QueueLength;
+    NewQueue->LockFree = (Flags & HS_QUEUE_LOCK_FREE) ? TRUE : FALSE;
+    NewQueue->Reactor = NULL;
+    NewQueue->ThreadHandle = NULL;
+    NewQueue->Active = FALSE;
+    NewQueue->UserWaiting = 0; NewQueue->RequesterWaiting = 0;
+    NewQueue->Waiters = NULL; NewQueue->AnyWaiting = 0;
+    NewQueue->Ring = NULL;
+    NewQueue->Head = 0; NewQueue->Reap = 0; NewQueue->Post = 0; NewQueue->Tail = 0;
+    NewQueue->Depth = QueueLength;
+    NewQueue->Pool = NULL;
+    NewQueue->Returned = NULL;
+    NewQueue->RetHead = 0; NewQueue->RetTail = 0;
+    NewQueue->PoolBuffers = NULL;
+    NewQueue->PoolData = NULL;
+    NewQueue->Allocations = 0;
+    memset(&NewQueue->Stats, 0, sizeof(HS_QUEUE_STATS));
+    NewQueue->FullSince = 0;
+    NewQueue->Timed = (Flags & HS_QUEUE_TIMING) ? TRUE : FALSE;
+    NewQueue->Latency = NULL;
+    NewQueue->Callback = Callback; NewQueue->CallbackContext = Context;
+    NewQueue->Stopped = FALSE;
+    NewQueue->EventFd = -1;
+    NewQueue->StallMs = 0;
+    NewQueue->ProgressNs = 0; NewQueue->AbortNs = 0;
+    NewQueue->Stalled = FALSE;
+    NewQueue->Recover = (Flags & HS_QUEUE_RECOVER) ? TRUE : FALSE;
+    NewQueue->Retries = 0;
+    NewQueue->Paused = FALSE; NewQueue->AbortWanted = FALSE; NewQueue->Recovering = FALSE;
+    NewQueue->Device = NULL; NewQueue->Closing = FALSE;
+    NewQueue->Flags = Flags;
+    NewQueue->PipeTimeoutMs = 0;
+    NewQueue->StallAbort = FALSE; NewQueue->NextStall = NULL;
+    InitializeCriticalSection(&NewQueue->BuffersMutex); //Kept until HS_DestroyQueue(), even while the thread is stopped.
+    InitializeConditionVariable(&NewQueue->RequesterCond);
+    InitializeConditionVariable(&NewQueue->UserCond);
+    EnterCriticalSection(&QueueListMutex); //Only held to claim the pipe.
+    Status = _ClaimPipe(NewQueue);
+    LeaveCriticalSection(&QueueListMutex);
+    if(Status != FT_OK)
+    {
+        DeleteCriticalSection(&NewQueue->BuffersMutex);
+        DeleteConditionVariable(&NewQueue->RequesterCond);
+        DeleteConditionVariable(&NewQueue->UserCond);
+        free(NewQueue);
+        return Status;
+    }
+    Status = _CreatePool(NewQueue); //Allocate every buffer the queue will use.
+    if(Status == FT_OK){Status = _CreateThread(NewQueue, (Flags & HS_QUEUE_REACTOR) ? TRUE : FALSE);} //Start servicing the queue.
+    if(Status != FT_OK){HS_DestroyQueue(NewQueue); return Status;}
+    *((PVOID *)NewQueueP) = NewQueue;
+    return Status;
+}
+
+/*
+    Returns the link to the params of Handle in OpenParams, the link to NULL if it has none. OpenMutex must be held.
+*/
+HS_OpenParams **_FindOpenParams(FT_HANDLE Handle)
+{
+    HS_OpenParams **Link = &OpenParams;
+    while(*Link && ((*Link)->Handle != Handle)){Link = &(*Link)->Next;}
+    return Link;
+}
+
+/*
+    Every D3XX.Create() goes through here. D3XX keeps the transfer params globally until the next create, so OpenMutex
+    is held from applying PerFifo until the handle is made and no other create takes them. PerFifo can be NULL.
+    If Reopened isn't NULL, the params it was opened with are used instead and move to the new handle.
+    A slow open doesn't hold up queues of other handles.
+*/
+FT_STATUS _CreateHandle(PVOID Arg, DWORD Flags, const HS_TRANSFER_CONFIG *PerFifo, FT_HANDLE Reopened, FT_HANDLE *Handle)
+{
+    ULONG i;
+    FT_STATUS Status = FT_OK;
+    HS_OpenParams *Params = NULL;
+    EnterCriticalSection(&OpenMutex);
+    if(Reopened)
+    {
+        Params = *_FindOpenParams(Reopened);
+        PerFifo = Params ? Params->PerFifo : NULL; //Opened by HS_Open(), nothing to apply.
+    }
+    else if(PerFifo) //Kept for HS_ReattachDevice().
+    {
+        Params = malloc(sizeof(HS_OpenParams));
+        if(!Params){Status = FT_NO_SYSTEM_RESOURCES;}
+        else{memcpy(Params->PerFifo, PerFifo, sizeof(Params->PerFifo));}
+    }
+    if(PerFifo && (Status == FT_OK) && !D3XX.SetTransferParams){Status = FT_NOT_SUPPORTED;} //Backend made before the entry existed.
+    for(i = 0; PerFifo && (i < HS_FIFO_COUNT) && (Status == FT_OK); ++i){Status = D3XX.SetTransferParams(&PerFifo[i], i);}
+    if(Status == FT_OK){Status = D3XX.Create(Arg, Flags, Handle);}
+    if((Status == FT_OK) && Params)
+    {
+        Params->Handle = *Handle;
+        if(!Reopened){Params->Next = OpenParams; OpenParams = Params;}
+    }
+    else if(!Reopened){free(Params);}
+    LeaveCriticalSection(&OpenMutex);
+    return Status;
+}
+
+/*
+    Wrapper for FT_Create(). So you don't need to import the D3XX library additionally to get a handle.
+*/
+HS_QD3XX_API FT_STATUS HS_Open(PVOID pvArg,DWORD dwFlags,FT_HANDLE *pftHandle)
+{
+    return _CreateHandle(pvArg, dwFlags, NULL, NULL, pftHandle);
+}
+
+/*
+    Fills in the values of a FIFO's transfer config left 0 from the queue geometry it will serve.
+    The driver then keeps as many bytes in flight as the queues do: QueueLength URBs of StreamSize each.
+*/
+FT_STATUS _DeriveTransferConfig(const HS_TRANSFER_CONFIG *Config, HS_TRANSFER_CONFIG *Derived)
+{
+    *Derived = *Config;
+    Derived->Flags &= ~HS_TRANSFER_SINGLE_THREAD; //Pipes are aborted from other threads, D3XX must keep locking them.
+    if((Config->URBCount > 255) || (Config->URBBufferCount > 0xFFFF)){return FT_INVALID_PARAMETER;} //BYTE & WORD in D3XX.
+    if(!Derived->URBCount && Config->QueueLength) //One URB per queue buffer.
+    {
+        Derived->URBCount = (Config->QueueLength < 2) ? 2 : ((Config->QueueLength > 255) ? 255 : Config->QueueLength);
+    }
+    if(!Derived->URBBufferSize && Config->StreamSize) //Whole packets so no URB ends on a short packet mid-stream.
+    {
+        Derived->URBBufferSize = (Config->StreamSize > HS_URB_MAX_SIZE) ? HS_URB_MAX_SIZE :
+                                 ((Config->StreamSize + HS_USB3_PACKET - 1) / HS_USB3_PACKET) * HS_USB3_PACKET;
+    }
+    return FT_OK;
+}
+
+/*
+    Derives every FIFO's transfer params, _CreateHandle() applies them and creates the handle.
+*/
+HS_QD3XX_API FT_STATUS HS_OpenEx(PVOID Arg, DWORD Flags, const HS_TRANSFER_CONFIG *PerFifo, FT_HANDLE *Handle)
+{
+    ULONG i;
+    FT_STATUS Status = FT_OK;
+    HS_TRANSFER_CONFIG Derived[HS_FIFO_COUNT];
+    if(!PerFifo){return _CreateHandle(Arg, Flags, NULL, NULL, Handle);}
+    if(!Handle){return FT_INVALID_PARAMETER;}
+    for(i = 0; i < HS_FIFO_COUNT; ++i)
+    {
+        Status = _DeriveTransferConfig(&PerFifo[i], &Derived[i]);
+        if(Status != FT_OK){return Status;}
+    }
+    return _CreateHandle(Arg, Flags, Derived, NULL, Handle);
+}
+
+/*
+    Wrapper for FT_Close(). So you don't need to import the D3XX library additionally to close a handle.
+*/
+HS_QD3XX_API FT_STATUS HS_Close(FT_HANDLE ftHandle)
+{
+    HS_OpenParams **Link, *Params = NULL;
+    if(QueueListReady) //Handles are often closed after HS_FreeQueueD3XX(), which already freed OpenParams.
+    {
+        EnterCriticalSection(&OpenMutex);
+        Link = _FindOpenParams(ftHandle);
+        Params = *Link;
+        if(Params){*Link = Params->Next;} //Before the close, D3XX can hand the handle out again after.
+        LeaveCriticalSection(&OpenMutex);
+    }
+    free(Params);
+    return D3XX.Close(ftHandle);
+}
+
+/*
+    Makes the device list again. The old list is kept if D3XX fails.
+*/
+HS_QD3XX_API FT_STATUS HS_RefreshDevices(PULONG Count)
+{
+    FT_STATUS Status = FT_OK;
+    DWORD NumDevices = 0;
+    FT_DEVICE_LIST_INFO_NODE *List = NULL;
+    if(!D3XX.CreateDeviceInfoList || !D3XX.GetDeviceInfoList){return FT_NOT_SUPPORTED;} //Backend made before the entries existed.
+    EnterCriticalSection(&DeviceInfoMutex);
+    Status = D3XX.CreateDeviceInfoList(&NumDevices);
+    if((Status == FT_OK) && NumDevices)
+    {
+        List = malloc(sizeof(FT_DEVICE_LIST_INFO_NODE) * NumDevices);
+        if(!List){Status = FT_NO_SYSTEM_RESOURCES;}
+        else{Status = D3XX.GetDeviceInfoList(List, &NumDevices);} //Lowers NumDevices if some went away since.
+    }
+    if(Status == FT_OK)
+    {
+        free(DeviceInfo);
+        DeviceInfo = List;
+        DeviceInfoCount = NumDevices;
+        if(Count){*Count = NumDevices;}
+    }
+    else{free(List);}
+    LeaveCriticalSection(&DeviceInfoMutex);
+    return Status;
+}
+
+HS_QD3XX_API FT_STATUS HS_GetDeviceInfo(ULONG Index, FT_DEVICE_LIST_INFO_NODE *Info)
+{
+    FT_STATUS Status = FT_OK;
+    if(!Info){return FT_INVALID_PARAMETER;}
+    EnterCriticalSection(&DeviceInfoMutex);
+    if(Index < DeviceInfoCount){*Info = DeviceInfo[Index];}
+    else{Status = FT_DEVICE_NOT_FOUND;}
+    LeaveCriticalSection(&DeviceInfoMutex);
+    return Status;
+}
+
+/*
+    Returns TRUE if the device list has Serial.
+*/
+BOOL _FindSerial(const char *Serial)
+{
+    ULONG i;
+    BOOL Found = FALSE;
+    EnterCriticalSection(&DeviceInfoMutex);
+    for(i = 0; (i < DeviceInfoCount) && !Found; ++i)
+    {
+        Found = !strncmp(DeviceInfo[i].SerialNumber, Serial, sizeof(DeviceInfo[i].SerialNumber));
+    }
+    LeaveCriticalSection(&DeviceInfoMutex);
+    return Found;
+}
+
+/*
+    Refreshes the device list for a serial it doesn't have, a device plugged in since shows up.
+    Opening is still tried if the backend can't list devices.
+*/
+HS_QD3XX_API FT_STATUS HS_OpenBySerial(const char *Serial, FT_HANDLE *Handle)
+{
+    FT_STATUS Status = FT_OK;
+    if(!Serial || !Handle){return FT_INVALID_PARAMETER;}
+    if(!_FindSerial(Serial))
+    {
+        Status = HS_RefreshDevices(NULL);
+        if(Status == FT_OK){Status = _FindSerial(Serial) ? FT_OK : FT_DEVICE_NOT_FOUND;}
+        else if(Status == FT_NOT_SUPPORTED){Status = FT_OK;}
+        if(Status != FT_OK){return Status;}
+    }
+    return _CreateHandle((PVOID)Serial, FT_OPEN_BY_SERIAL_NUMBER, NULL, NULL, Handle);
+}
+
+/*
+    Stops every queue of Handle first, then restarts them on the new handle one by one.
+    Queues are marked Closing meanwhile so HS_DestroyQueue() and the watchdog's recoveries leave them alone.
+*/
+HS_QD3XX_API FT_STATUS HS_ReattachDevice(FT_HANDLE Handle, const char *Serial, FT_HANDLE *NewHandle)
+{
+    ULONG i, Count = 0;
+    FT_STATUS Status, Result = FT_OK;
+    HS_Device *Device = NULL;
+    HS_Queue *Queues[HS_DEVICE_PIPES];
+    if(!Handle || !Serial || !NewHandle){return FT_INVALID_PARAMETER;}
+    Status = HS_RefreshDevices(NULL); //The device may have come back under another index.
+    if((Status != FT_OK) && (Status != FT_NOT_SUPPORTED)){return Status;}
+    Status = _CreateHandle((PVOID)Serial, FT_OPEN_BY_SERIAL_NUMBER, NULL, Handle, NewHandle); //With HS_OpenEx()'s params.
+    if(Status != FT_OK){return Status;}
+    EnterCriticalSection(&QueueListMutex);
+    for(Device = DeviceTable[_DeviceBucket(Handle)]; Device && (Device->Handle != Handle); Device = Device->Next);
+    for(i = 0; Device && (i < HS_DEVICE_PIPES); ++i)
+    {
+        if(!Device->Queues[i] || Device->Queues[i]->Closing){continue;} //Being destroyed, leave it to HS_DestroyQueue().
+        Device->Queues[i]->Closing = TRUE;
+        Queues[Count++] = Device->Queues[i];
+    }
+    for(i = 0; i < Count; ++i){_WaitStallAbort(Queues[i]);} //Its Handle is about to change.
+    LeaveCriticalSection(&QueueListMutex);
+    for(i = 0; i < Count; ++i){_StopQueue(Queues[i]);} //Stop them all before any uses the new handle.
+    for(i = 0; i < Count; ++i)
+    {
+        Status = _RestartQueue(Queues[i], *NewHandle);
+        if((Status != FT_OK) && (Result == FT_OK)){Result = Status;}
+        EnterCriticalSection(&QueueListMutex);
+        Queues[i]->Closing = FALSE; //A queue that failed can be destroyed now.
+        LeaveCriticalSection(&QueueListMutex);
+    }
+    D3XX.Close(Handle); //Gone from the bus, closing only frees D3XX's side of it.
+    return Result;
+}
+
+HS_QD3XX_API FT_STATUS HS_CreateQueue(FT_HANDLE Handle, UCHAR PipeID, ULONG StreamSize, ULONG QueueLength, BOOL Fixed, HS_QUEUE *NewQueueP)
+{
+    return HS_CreateQueueEx(Handle, PipeID, StreamSize, QueueLength, Fixed ? HS_QUEUE_FIXED : 0, NewQueueP);
+}
+
+/*
+    Sets up the pipe for the HS_QUEUE_ flags and adds the queue. Callback is NULL unless it's a callback queue.
+*/
+FT_STATUS _CreateQueue(FT_HANDLE Handle, UCHAR PipeID, ULONG StreamSize, ULONG QueueLength, ULONG Flags,
+                       HS_READ_CALLBACK Callback, PVOID Context, HS_QUEUE *NewQueueP)
+{
+    FT_STATUS Status = FT_OK;
+    if(Flags & ~(HS_QUEUE_FIXED | HS_QUEUE_LOCK_FREE | HS_QUEUE_REACTOR | HS_QUEUE_TIMING | HS_QUEUE_RECOVER)){return FT_INVALID_PARAMETER;}
+    if(Flags & HS_QUEUE_FIXED){Status = D3XX.SetStreamPipe(Handle, FALSE, FALSE, PipeID, StreamSize);}
+    else{Status = D3XX.ClearStreamPipe(Handle, FALSE, FALSE, PipeID);}
+    if(Status != FT_OK){return Status;}
+    Status = AddQueue(Handle, PipeID, StreamSize, QueueLength, Flags, Callback, Context, NewQueueP);
+    return Status;
+}
+
+/*
+    Same as HS_CreateQueue() but takes HS_QUEUE_ flags.
+*/
+HS_QD3XX_API FT_STATUS HS_CreateQueueEx(FT_HANDLE Handle, UCHAR PipeID, ULONG StreamSize, ULONG QueueLength, ULONG Flags, HS_QUEUE *NewQueueP)
+{
+    return _CreateQueue(Handle, PipeID, StreamSize, QueueLength, Flags, NULL, NULL, NewQueueP);
+}
+
+/*
+    Creates an IN queue whose thread hands finished reads to Callback. Reactors are left out, their thread
+    sweeps every queue of the handle and one slow callback would hold up the rest.
+*/
+HS_QD3XX_API FT_STATUS HS_CreateQueueWithCallback(FT_HANDLE Handle, UCHAR PipeID, ULONG StreamSize, ULONG QueueLength, ULONG Flags,
+                                                  HS_READ_CALLBACK Callback, PVOID Context, HS_QUEUE *NewQueueP)
+{
+    if((!Callback) || (!(PipeID & 0x80)) || (Flags & HS_QUEUE_REACTOR)){return FT_INVALID_PARAMETER;}
+    return _CreateQueue(Handle, PipeID, StreamSize, QueueLength, Flags, Callback, Context, NewQueueP);
+}
+
+/*
+    Stops the queue without QueueListMutex, so queues of other handles and pipes can be made meanwhile.
+    The pipe stays claimed until the queue's thread is stopped, a new queue for it gets FT_RESERVED_PIPE until then.
+*/
+HS_QD3XX_API FT_STATUS HS_DestroyQueue(HS_QUEUE DQueue)
+{
+    HS_Queue *Temp = DQueue;
+    if(!DQueue){return FT_INVALID_PARAMETER;}
+    EnterCriticalSection(&QueueListMutex);
+    if(!QueueSize){LeaveCriticalSection(&QueueListMutex); return FT_NO_MORE_ITEMS;}
+    if(Temp->Closing){LeaveCriticalSection(&QueueListMutex); return FT_INVALID_PARAMETER;} //Another call is destroying it.
+    Temp->Closing = TRUE;
+    _WaitStallAbort(Temp);
+    LeaveCriticalSection(&QueueListMutex);
+    _StopQueue(Temp);
+    _DestroyPool(Temp); //Thread is stopped, nothing uses the buffers anymore.
+    #ifndef _WIN32
+        if(Temp->EventFd >= 0){close(Temp->EventFd);}
+    #endif //_WIN32
+    EnterCriticalSection(&QueueListMutex);
+    _ReleasePipe(Temp->Device, Temp->PipeID); //The watchdog can't be looking at it now.
+    LeaveCriticalSection(&QueueListMutex);
+    DeleteCriticalSection(&Temp->BuffersMutex);
+    DeleteConditionVariable(&Temp->RequesterCond);
+    DeleteConditionVariable(&Temp->UserCond);
+    free(Temp);
+    return FT_OK;
+}
+
+/*
+    Copies data read from queue to ReadBuffer.
+    Fails if queue is for an OUT pipe.
+    Will destroy the queue if the pipe has been aborted and needs to undergo the abort procedure.
+*/
+HS_QD3XX_API FT_STATUS HS_ReadQueue(HS_QUEUE *Queue, PUCHAR ReadBuffer, PULONG BytesTransferred, BOOL Wait)
+{
+    return HS_ReadQueueTimeout(Queue, ReadBuffer, BytesTransferred, Wait ? INFINITE : 0);
+}
+
+/*
+    Same as HS_ReadQueue() but waits up to Timeout milliseconds for a read to finish.
+    Returns FT_TIMEOUT if the time ran out, a Timeout of 0 returns immediately like HS_ReadQueue().
+*/
+HS_QD3XX_API FT_STATUS HS_ReadQueueTimeout(HS_QUEUE *Queue, PUCHAR ReadBuffer, PULONG BytesTransferred, DWORD Timeout)
+{
+    FT_STATUS Status;
+    PUCHAR Data = NULL;
+    if((!Queue) || (!ReadBuffer) || (!BytesTransferred)){return FT_INVALID_PARAMETER;}
+    HS_QUEUE Temp = *Queue;
+    Status = HS_AcquireReadBuffer(Queue, &Data, BytesTransferred, Timeout);
+    if(Status != FT_OK){return Status;}
+    memcpy(ReadBuffer, Data, *BytesTransferred);
+    return HS_ReleaseReadBuffer(Temp, Data);
+}
+
+/*
+    Gives the user the oldest finished read buffer of the queue without copying it.
+    The buffer isn't reused for reads until HS_ReleaseReadBuffer() is called.
+*/
+HS_QD3XX_API FT_STATUS HS_AcquireReadBuffer(HS_QUEUE *Queue, PUCHAR *ReadBuffer, PULONG BytesTransferred, DWORD Timeout)
+{
+    FT_STATUS Status;
+    if((!Queue) || (!ReadBuffer) || (!BytesTransferred)){return FT_INVALID_PARAMETER;}
+    if(!(*Queue)){return FT_INVALID_PARAMETER;}
+    HS_Queue *Temp = *Queue;
+    HS_Buffer *TempBuffer = NULL;
+    *ReadBuffer = NULL;
+    if(!(Temp->PipeID & 0x80)){return FT_INVALID_PARAMETER;} //Return if queue is for a OUT pipe.
+    if(Temp->Callback){return FT_NOT_SUPPORTED;} //Reads go to the callback.
+    if(!Temp->LockFree){EnterCriticalSection(&Temp->BuffersMutex);}
+    if(!_WaitUser(Temp, _ReadReady, Timeout)) //Wait for _QueueRequester to finish a read.
+    {
+        Status = Timeout ? FT_TIMEOUT : ((Temp->Head != HS_LoadAcquire(&Temp->Tail)) ? FT_IO_INCOMPLETE : FT_NO_MORE_ITEMS);
+        if(!Temp->LockFree){LeaveCriticalSection(&Temp->BuffersMutex);}
+        return Status;
+    }
+    TempBuffer = Temp->Ring[_RingSlot(Temp, Temp->Head)]; //Get oldest buffer in queue.
+    Status = TempBuffer->Status;
+    *BytesTransferred = TempBuffer->BytesTransferred; //Set bytes transferred.
+    if(Status != FT_OK)
+    { //If the read pipe call failed, destroy the queue.
+        if(!Temp->LockFree){LeaveCriticalSection(&Temp->BuffersMutex);}
+        *Queue = NULL; //Set the Queue to NULL so the user doesn't try to use it.
+        HS_DestroyQueue(Temp); //Destroy the queue.
+        return Status;
+    }
+    TempBuffer->Lent = TRUE; //Goes back to the pool in HS_ReleaseReadBuffer().
+    if(Temp->Timed){_RecordLatency(&Temp->Latency[HS_LATENCY_USER], _GetTimeNs() - TempBuffer->DoneNs);}
+    _PopBuffer(Temp);
+    if(!Temp->LockFree){LeaveCriticalSection(&Temp->BuffersMutex);}
+    *ReadBuffer = TempBuffer->Buffer;
+    return FT_OK;
+}
+
+/*
+    Gives a buffer from HS_AcquireReadBuffer() back to the queue so it can be read into again.
+*/
+HS_QD3XX_API FT_STATUS HS_ReleaseReadBuffer(HS_QUEUE Queue, PUCHAR ReadBuffer)
+{
+    if((!Queue) || (!ReadBuffer)){return FT_INVALID_PARAMETER;}
+    HS_Queue *Temp = Queue;
+    HS_Buffer *TempBuffer = NULL;
+    if(!(Temp->PipeID & 0x80)){return FT_INVALID_PARAMETER;} //Return if queue is for a OUT pipe.
+    if(!Temp->LockFree){EnterCriticalSection(&Temp->BuffersMutex);}
+    TempBuffer = _FindLentBuffer(Temp, ReadBuffer);
+    if(!TempBuffer) //Not acquired or already released.
+    {
+        if(!Temp->LockFree){LeaveCriticalSection(&Temp->BuffersMutex);}
+        return FT_INVALID_PARAMETER;
+    }
+    TempBuffer->Lent = FALSE;
+    _ReturnBuffer(Temp, TempBuffer); //Buffer can be used for another read.
+    _WakeRequester(Temp); //Space freed up for another read pipe call.
+    if(!Temp->LockFree){LeaveCriticalSection(&Temp->BuffersMutex);}
+    return FT_OK;
+}
+
+/*
+    Copies every done read up to MaxCount with one lock acquisition, one Head/RetTail store and one wake.
+    Stops before a failed read unless it's the first, which destroys the queue like HS_AcquireReadBuffer().
+*/
+HS_QD3XX_API FT_STATUS HS_ReadQueueBatch(HS_QUEUE *Queue, HS_READ_VEC *Reads, ULONG MaxCount, PULONG Count, DWORD Timeout)
+{
+    FT_STATUS Status;
+    ULONG i, Head, Reap, RetTail;
+    if((!Queue) || (!Reads) || (!MaxCount) || (!Count)){return FT_INVALID_PARAMETER;}
+    if(!(*Queue)){return FT_INVALID_PARAMETER;}
+    HS_Queue *Temp = *Queue;
+    HS_Buffer *TempBuffer = NULL;
+    *Count = 0;
+    if(!(Temp->PipeID & 0x80)){return FT_INVALID_PARAMETER;} //Return if queue is for a OUT pipe.
+    if(Temp->Callback){return FT_NOT_SUPPORTED;} //Reads go to the callback.
+    for(i = 0; i < MaxCount; ++i){if(!Reads[i].Buffer){return FT_INVALID_PARAMETER;}}
+    if(!Temp->LockFree){EnterCriticalSection(&Temp->BuffersMutex);}
+    if(!_WaitUser(Temp, _ReadReady, Timeout)) //Wait for _QueueRequester to finish a read.
+    {
+        Status = Timeout ? FT_TIMEOUT : ((Temp->Head != HS_LoadAcquire(&Temp->Tail)) ? FT_IO_INCOMPLETE : FT_NO_MORE_ITEMS);
+        if(!Temp->LockFree){LeaveCriticalSection(&Temp->BuffersMutex);}
+        return Status;
+    }
+    Head = Temp->Head;
+    Reap = HS_LoadAcquire(&Temp->Reap); //Everything done up to here.
+    RetTail = Temp->RetTail;
+    for(i = 0; (i < MaxCount) && (Head != Reap); ++i)
+    {
+        TempBuffer = Temp->Ring[_RingSlot(Temp, Head)];
+        if(TempBuffer->Status != FT_OK){break;} //Leave it for the next call.
+        memcpy(Reads[i].Buffer, TempBuffer->Buffer, TempBuffer->BytesTransferred);
+        Reads[i].BytesTransferred = TempBuffer->BytesTransferred;
+        if(Temp->Timed){_RecordLatency(&Temp->Latency[HS_LATENCY_USER], _GetTimeNs() - TempBuffer->DoneNs);}
+        Temp->Returned[_RingSlot(Temp, RetTail)] = TempBuffer;
+        Head = _RingNext(Temp, Head);
+        RetTail = _RingNext(Temp, RetTail);
+    }
+    if(!i) //The oldest read failed, destroy the queue.
+    {
+        Status = TempBuffer->Status;
+        if(!Temp->LockFree){LeaveCriticalSection(&Temp->BuffersMutex);}
+        *Queue = NULL; //Set the Queue to NULL so the user doesn't try to use it.
+        HS_DestroyQueue(Temp); //Destroy the queue.
+        return Status;
+    }
+    HS_StoreRelease(&Temp->Head, Head); //Free the ring slots before the buffers can be added again.
+    HS_StoreRelease(&Temp->RetTail, RetTail); //Buffers can be used for more reads.
+    _WakeRequester(Temp); //Space freed up for more read pipe calls.
+    if(!Temp->LockFree){LeaveCriticalSection(&Temp->BuffersMutex);}
+    *Count = i;
+    return FT_OK;
+}
+
+/*
+    Copies data from WriteBuffer to queue.
+    Fails if queue is for an IN pipe.
+    Returns FT_BUSY if the queue is full.
+    If Wait is true, HS_WriteQueue() won't return until WriteBuffer is copied into the queue.
+*/
+HS_QD3XX_API FT_STATUS HS_WriteQueue(HS_QUEUE Queue, PUCHAR WriteBuffer, BOOL Wait)
+{
+    if(!Queue){return FT_INVALID_PARAMETER;}
+    HS_Queue *Temp = Queue;
+    return HS_WriteQueueEx(Queue, WriteBuffer, Temp->StreamSize, 0, Wait ? INFINITE : 0);
+}
+
+/*
+    Copies Length bytes from WriteBuffer to queue, only Length bytes are written out.
+    HS_WRITE_PAD zero fills the rest of the buffer and writes out StreamSize bytes.
+    Returns FT_BUSY if the queue is full and Timeout is 0, FT_TIMEOUT if it stayed full for Timeout milliseconds.
+*/
+HS_QD3XX_API FT_STATUS HS_WriteQueueEx(HS_QUEUE Queue, PUCHAR WriteBuffer, ULONG Length, ULONG Flags, DWORD Timeout)
+{
+    FT_STATUS Status;
+    PUCHAR Data = NULL;
+    if((!Queue) || (!WriteBuffer)){return FT_INVALID_PARAMETER;}
+    HS_Queue *Temp = Queue;
+    if((Length < 1) || (Length > Temp->StreamSize) || (Flags & ~HS_WRITE_PAD)){return FT_INVALID_PARAMETER;}
+    Status = HS_AcquireWriteBuffer(Queue, &Data, Timeout);
+    if(Status != FT_OK){return Status;}
+    memcpy(Data, WriteBuffer, Length); //Copy data, nobody else can touch the buffer.
+    if(Flags & HS_WRITE_PAD)
+    {
+        memset(Data + Length, 0, Temp->StreamSize - Length);
+        Length = Temp->StreamSize;
+    }
+    return HS_CommitWriteBuffer(Queue, Data, Length);
+}
+
+/*
+    Copies buffers into the pool's free buffers with one lock acquisition, one Tail store and one wake.
+*/
+HS_QD3XX_API FT_STATUS HS_WriteQueueBatch(HS_QUEUE Queue, PUCHAR *WriteBuffers, PULONG Lengths, ULONG Count, PULONG Accepted, DWORD Timeout)
+{
+    ULONG i, Tail, Used;
+    ULONGLONG Now = 0;
+    if((!Queue) || (!WriteBuffers) || (!Count) || (!Accepted)){return FT_INVALID_PARAMETER;}
+    HS_Queue *Temp = Queue;
+    HS_Buffer *TempBuffer = NULL;
+    *Accepted = 0;
+    if(Temp->PipeID & 0x80){return FT_INVALID_PARAMETER;} //Return if queue is for an IN pipe.
+    for(i = 0; i < Count; ++i)
+    {
+        if(!WriteBuffers[i]){return FT_INVALID_PARAMETER;}
+        if(Lengths && ((Lengths[i] < 1) || (Lengths[i] > Temp->StreamSize))){return FT_INVALID_PARAMETER;}
+    }
+    if(!Temp->LockFree){EnterCriticalSection(&Temp->BuffersMutex);}
+    if(!_PoolReady(Temp)){_MarkFull(Temp);}
+    if(!_WaitUser(Temp, _PoolReady, Timeout)) //Wait for HS_GetWriteStatus() to free space.
+    {
+        if(!Temp->LockFree){LeaveCriticalSection(&Temp->BuffersMutex);}
+        return Timeout ? FT_TIMEOUT : FT_BUSY;
+    }
+    if(Temp->Timed){Now = _GetTimeNs();} //One stamp for the whole batch.
+    Tail = Temp->Tail;
+    for(i = 0; (i < Count) && (TempBuffer = _TakeBuffer(Temp)); ++i)
     {
-        HS_DestroyQueue(QueueList);
+        TempBuffer->Length = Lengths ? Lengths[i] : Temp->StreamSize;
+        memcpy(TempBuffer->Buffer, WriteBuffers[i], TempBuffer->Length);
+        TempBuffer->QueuedNs = Now;
+        Temp->Ring[_RingSlot(Temp, Tail)] = TempBuffer; //Ring can't overflow, it has a slot for every buffer.
+        Tail = _RingNext(Temp, Tail);
     }
-    DeleteCriticalSection(&QueueListMutex);
+    HS_StoreRelease(&Temp->Tail, Tail); //Publish the buffers.
+    Used = _RingCount(Temp, HS_LoadRelaxed(&Temp->Head), Tail);
+    if(Used > Temp->Stats.HighWater){HS_StoreRelaxed(&Temp->Stats.HighWater, Used);}
+    _WakeRequester(Temp); //Tell the thread there's data to write out.
+    if(!Temp->LockFree){LeaveCriticalSection(&Temp->BuffersMutex);}
+    *Accepted = i;
+    return FT_OK;
 }
 
 /*
-    Add a buffer to the queue for read/write calls.
-    If WriteData is not null, NewBuffer->Buffer points to it.
-    If PNewBuffer is not null, NewBuffer address is written to *PNewBuffer. NULL on failure to add a buffer.
-    Called by main and child threads. Increments read & write queues on success.
-    EnterCritical must be FALSE if you're controlling the BuffersMutex outside the function.
+    Gives the user an empty buffer from the queue's pool to fill with data to write out.
+    Returns FT_BUSY if the queue is full and Timeout is 0, FT_TIMEOUT if the queue stayed full for Timeout milliseconds.
 */
-FT_STATUS _AddBuffer(HS_Queue *Queue, PUCHAR WriteData, HS_Buffer **PNewBuffer, BOOL EnterCritical)
+HS_QD3XX_API FT_STATUS HS_AcquireWriteBuffer(HS_QUEUE Queue, PUCHAR *WriteBuffer, DWORD Timeout)
 {
-    if(EnterCritical){EnterCriticalSection(&Queue->BuffersMutex);}
-    if(PNewBuffer){*PNewBuffer = NULL;}
-    if((Queue->Size + Queue->SizeWS) >= Queue->QueueLength) //Queue max length must not be surpassed.
-    {
-        if(EnterCritical){LeaveCriticalSection(&Queue->BuffersMutex);}
-        return FT_BUSY; //User needs to wait until queue gains space.
-    }
-    HS_Buffer *NewBuffer = malloc(sizeof(HS_Buffer));
-    if(!NewBuffer){if(EnterCritical){LeaveCriticalSection(&Queue->BuffersMutex);} return FT_NO_SYSTEM_RESOURCES;}
-    if(WriteData) //If we're assigned data to being written out.
-    {
-        NewBuffer->Buffer = WriteData; //Assign data to write out.
-    }
-    else //Create buffer to hold incoming data.
-    {
-        NewBuffer->Buffer = malloc(Queue->StreamSize);
-        if(!NewBuffer->Buffer)
-        {
-            free(NewBuffer);
-            if(EnterCritical){LeaveCriticalSection(&Queue->BuffersMutex);} return FT_NO_SYSTEM_RESOURCES;
-        }
-    }
-    if(FT_InitializeOverlapped(Queue->Handle,&NewBuffer->Overlap) != FT_OK)
+    if((!Queue) || (!WriteBuffer)){return FT_INVALID_PARAMETER;}
+    HS_Queue *Temp = Queue;
+    HS_Buffer *TempBuffer = NULL;
+    *WriteBuffer = NULL;
+    if(Temp->PipeID & 0x80){return FT_INVALID_PARAMETER;} //Return if queue is for an IN pipe.
+    if(!Temp->LockFree){EnterCriticalSection(&Temp->BuffersMutex);}
+    if(!_PoolReady(Temp)){_MarkFull(Temp);}
+    if(!_WaitUser(Temp, _PoolReady, Timeout)) //Wait for HS_GetWriteStatus() to free space.
     {
-        free(NewBuffer->Buffer); free(NewBuffer);
-        if(EnterCritical){LeaveCriticalSection(&Queue->BuffersMutex);} return FT_NO_SYSTEM_RESOURCES;
+        if(!Temp->LockFree){LeaveCriticalSection(&Temp->BuffersMutex);}
+        return Timeout ? FT_TIMEOUT : FT_BUSY;
     }
-    NewBuffer->Status = FT_IO_PENDING; //Waiting for read/write call to happen or finish.
+    TempBuffer = _TakeBuffer(Temp); //Get a buffer from the pool.
+    TempBuffer->Lent = TRUE;
+    if(!Temp->LockFree){LeaveCriticalSection(&Temp->BuffersMutex);}
+    *WriteBuffer = TempBuffer->Buffer;
+    return FT_OK;
+}
 
-    if(!Queue->Buffers) //Create Buffer list.
+/*
+    Queues Length bytes of a buffer from HS_AcquireWriteBuffer() to be written out.
+    A Length of 0 gives the buffer back without writing it.
+*/
+HS_QD3XX_API FT_STATUS HS_CommitWriteBuffer(HS_QUEUE Queue, PUCHAR WriteBuffer, ULONG Length)
+{
+    if((!Queue) || (!WriteBuffer)){return FT_INVALID_PARAMETER;}
+    HS_Queue *Temp = Queue;
+    HS_Buffer *TempBuffer = NULL;
+    if(Temp->PipeID & 0x80){return FT_INVALID_PARAMETER;} //Return if queue is for an IN pipe.
+    if(Length > Temp->StreamSize){return FT_INVALID_PARAMETER;}
+    if(!Temp->LockFree){EnterCriticalSection(&Temp->BuffersMutex);}
+    TempBuffer = _FindLentBuffer(Temp, WriteBuffer);
+    if(!TempBuffer) //Not acquired or already committed.
     {
-        Queue->Buffers = NewBuffer;
-        Queue->Buffers->Prev = NewBuffer;
-        Queue->Buffers->Next = NewBuffer;
+        if(!Temp->LockFree){LeaveCriticalSection(&Temp->BuffersMutex);}
+        return FT_INVALID_PARAMETER;
     }
-    else
+    TempBuffer->Lent = FALSE;
+    if(!Length) //Nothing to write, back to the pool.
     {
-        //Insert NewBuffer into Buffer list as last item.
-        Queue->Buffers->Prev->Next = NewBuffer;
-        NewBuffer->Next = Queue->Buffers;
-        NewBuffer->Prev = Queue->Buffers->Prev;
-        Queue->Buffers->Prev = NewBuffer;
+        _PutBackBuffer(Temp, TempBuffer);
+        _WakeUser(Temp); //Space freed up for HS_AcquireWriteBuffer().
+        if(!Temp->LockFree){LeaveCriticalSection(&Temp->BuffersMutex);}
+        return FT_OK;
     }
-    Queue->Size += 1;
-    if(PNewBuffer){*PNewBuffer = NewBuffer;}
-    if(EnterCritical){LeaveCriticalSection(&Queue->BuffersMutex);}
+    TempBuffer->Length = Length;
+    _AddBuffer(Temp, TempBuffer); //Add buffer to queue.
+    _WakeRequester(Temp); //Tell the thread there's data to write out.
+    if(!Temp->LockFree){LeaveCriticalSection(&Temp->BuffersMutex);}
     return FT_OK;
 }
 
 /*
-    Removes the oldest buffer in the queue. For read queues only.
-    Assumes queue is not empty.
-    //Only called by main thread. Decrements read queues.
+    Get the status of the oldest write in the queue.
+*/
+HS_QD3XX_API FT_STATUS HS_GetWriteStatus(HS_QUEUE *Queue, PULONG BytesTransferred, BOOL Wait)
+{
+    return HS_GetWriteStatusTimeout(Queue, BytesTransferred, Wait ? INFINITE : 0);
+}
+
+/*
+    Same as HS_GetWriteStatus() but waits up to Timeout milliseconds for a write to finish.
+    Returns FT_TIMEOUT if the time ran out, a Timeout of 0 returns immediately like HS_GetWriteStatus().
 */
-FT_STATUS _DestroyBuffer(HS_Queue *Queue)
+HS_QD3XX_API FT_STATUS HS_GetWriteStatusTimeout(HS_QUEUE *Queue, PULONG BytesTransferred, DWORD Timeout)
 {
-    EnterCriticalSection(&Queue->BuffersMutex);
-    HS_Buffer *Temp = Queue->Buffers; //Temp is equal to oldest buffer.
-    FT_ReleaseOverlapped(Queue->Handle, &Temp->Overlap); //Release the overlap.
-    if(Queue->Size == 1)
+    return HS_GetWriteStatusEx(Queue, BytesTransferred, NULL, Timeout);
+}
+
+/*
+    Same as HS_GetWriteStatusTimeout() but also gets the number of bytes the write asked for.
+    Length can be NULL.
+*/
+HS_QD3XX_API FT_STATUS HS_GetWriteStatusEx(HS_QUEUE *Queue, PULONG BytesTransferred, PULONG Length, DWORD Timeout)
+{
+    FT_STATUS Status;
+    if((!Queue) || (!BytesTransferred)){return FT_INVALID_PARAMETER;}
+    if(!(*Queue)){return FT_INVALID_PARAMETER;}
+    HS_Queue *Temp = *Queue;
+    HS_Buffer *TempBuffer = NULL;
+    if(Temp->PipeID & 0x80){return FT_INVALID_PARAMETER;} //Return if queue is for an IN pipe.
+    if(!Temp->LockFree){EnterCriticalSection(&Temp->BuffersMutex);}
+    if(!_WaitUser(Temp, _StatusReady, Timeout)) //Wait for _QueueRequester to finish a write.
+    {   //^We're waiting for a write to happen or finish.
+        Status = Timeout ? FT_TIMEOUT : ((Temp->Head != HS_LoadAcquire(&Temp->Post)) ? FT_IO_INCOMPLETE : FT_IO_PENDING);
+        if(!Temp->LockFree){LeaveCriticalSection(&Temp->BuffersMutex);}
+        return Status;
+    }
+    if(Temp->Head == HS_LoadAcquire(&Temp->Reap)) //No writes have been queued up.
     {
-        free(Queue->Buffers->Buffer); //Free buffer, it should exist.
-        free(Queue->Buffers);
-        Queue->Buffers = NULL;
+        if(!Temp->LockFree){LeaveCriticalSection(&Temp->BuffersMutex);}
+        return FT_NO_MORE_ITEMS;
     }
-    else
+    TempBuffer = Temp->Ring[_RingSlot(Temp, Temp->Head)];
+    Status = TempBuffer->Status;
+    *BytesTransferred = TempBuffer->BytesTransferred;
+    if(Length){*Length = TempBuffer->Length;}
+    if(Status != FT_OK)
     {
-        if(Temp == Queue->Buffers){Queue->Buffers = Temp->Next;}
-        Temp->Prev->Next = Temp->Next;
-        Temp->Next->Prev = Temp->Prev;
-        free(Temp->Buffer); //Free buffer, it should exist.
-        free(Temp);
+        if(!Temp->LockFree){LeaveCriticalSection(&Temp->BuffersMutex);}
+        *Queue = NULL; //Set the Queue to NULL so the user doesn't try to use it.
+        HS_DestroyQueue(Temp); //Destroy the queue.
+        return Status;
     }
-    Queue->Size -= 1;
-    LeaveCriticalSection(&Queue->BuffersMutex);
+    if(Temp->Timed){_RecordLatency(&Temp->Latency[HS_LATENCY_USER], _GetTimeNs() - TempBuffer->DoneNs);}
+    _ReturnBuffer(Temp, _PopBuffer(Temp)); //Recycle buffer as we got its status.
+    _WakeUser(Temp); //Space freed up for HS_AcquireWriteBuffer().
+    if(!Temp->LockFree){LeaveCriticalSection(&Temp->BuffersMutex);}
     return FT_OK;
 }
 
 /*
-    Retrieves the oldest buffer in the queue. For write queues.
-    Moves the oldest buffer to the WriteStatus queue.
-    Assumes queue is not empty.
-    Only called by child thread. Decrements write queues.
+    Retires every finished write up to MaxCount with one lock acquisition, one Head/RetTail store and one wake.
+    Stops before a failed write unless it's the first, which destroys the queue like HS_GetWriteStatusEx().
 */
-FT_STATUS _RetrieveBuffer(HS_Queue *Queue)
+HS_QD3XX_API FT_STATUS HS_GetWriteStatusBatch(HS_QUEUE *Queue, PULONG BytesTransferred, PULONG Lengths, ULONG MaxCount, PULONG Count, DWORD Timeout)
 {
-    EnterCriticalSection(&Queue->BuffersMutex);
-    HS_Buffer *Temp = Queue->Buffers; //Temp is equal to oldest buffer.
-    FT_ReleaseOverlapped(Queue->Handle,&Temp->Overlap); //Release the overlap.
-    //Remove oldest buffer from queue.
-    if(Queue->Size == 1)
+    FT_STATUS Status;
+    ULONG i, Head, Reap, RetTail;
+    if((!Queue) || (!MaxCount) || (!Count)){return FT_INVALID_PARAMETER;}
+    if(!(*Queue)){return FT_INVALID_PARAMETER;}
+    HS_Queue *Temp = *Queue;
+    HS_Buffer *TempBuffer = NULL;
+    *Count = 0;
+    if(Temp->PipeID & 0x80){return FT_INVALID_PARAMETER;} //Return if queue is for an IN pipe.
+    if(!Temp->LockFree){EnterCriticalSection(&Temp->BuffersMutex);}
+    if(!_WaitUser(Temp, _StatusReady, Timeout)) //Wait for _QueueRequester to finish a write.
     {
-        Queue->Buffers = NULL;
+        Status = Timeout ? FT_TIMEOUT : ((Temp->Head != HS_LoadAcquire(&Temp->Post)) ? FT_IO_INCOMPLETE : FT_IO_PENDING);
+        if(!Temp->LockFree){LeaveCriticalSection(&Temp->BuffersMutex);}
+        return Status;
     }
-    else
+    Head = Temp->Head;
+    Reap = HS_LoadAcquire(&Temp->Reap); //Everything done up to here.
+    if(Head == Reap) //No writes have been queued up.
     {
-        if(Temp == Queue->Buffers){Queue->Buffers = Temp->Next;}
-        Temp->Prev->Next = Temp->Next;
-        Temp->Next->Prev = Temp->Prev;
+        if(!Temp->LockFree){LeaveCriticalSection(&Temp->BuffersMutex);}
+        return FT_NO_MORE_ITEMS;
     }
-    Queue->Size -= 1;
-    //Add oldest buffer to WriteStatus queue.
-    if(!Queue->WriteStatus) //Create WriteStatus queue.
+    RetTail = Temp->RetTail;
+    for(i = 0; (i < MaxCount) && (Head != Reap); ++i)
     {
-        Queue->WriteStatus = Temp;
-        Queue->WriteStatus->Prev = Temp;
-        Queue->WriteStatus->Next = Temp;
+        TempBuffer = Temp->Ring[_RingSlot(Temp, Head)];
+        if(TempBuffer->Status != FT_OK){break;} //Leave it for the next call.
+        if(BytesTransferred){BytesTransferred[i] = TempBuffer->BytesTransferred;}
+        if(Lengths){Lengths[i] = TempBuffer->Length;}
+        if(Temp->Timed){_RecordLatency(&Temp->Latency[HS_LATENCY_USER], _GetTimeNs() - TempBuffer->DoneNs);}
+        Temp->Returned[_RingSlot(Temp, RetTail)] = TempBuffer;
+        Head = _RingNext(Temp, Head);
+        RetTail = _RingNext(Temp, RetTail);
     }
-    else
+    if(!i) //The oldest write failed, destroy the queue.
     {
-        //Insert oldest buffer into Queue->WriteStatus as last item.
-        Queue->WriteStatus->Prev->Next = Temp;
-        Temp->Next = Queue->WriteStatus;
-        Temp->Prev = Queue->WriteStatus->Prev;
-        Queue->WriteStatus->Prev = Temp;
+        Status = TempBuffer->Status;
+        if(BytesTransferred){BytesTransferred[0] = TempBuffer->BytesTransferred;}
+        if(Lengths){Lengths[0] = TempBuffer->Length;}
+        if(!Temp->LockFree){LeaveCriticalSection(&Temp->BuffersMutex);}
+        *Queue = NULL; //Set the Queue to NULL so the user doesn't try to use it.
+        HS_DestroyQueue(Temp); //Destroy the queue.
+        return Status;
     }
-    Queue->SizeWS += 1; //Size of WriteStatus queue increased.
-    LeaveCriticalSection(&Queue->BuffersMutex);
+    HS_StoreRelease(&Temp->Head, Head); //Free the ring slots before the buffers can be added again.
+    HS_StoreRelease(&Temp->RetTail, RetTail); //Recycle buffers as we got their statuses.
+    _WakeUser(Temp); //Space freed up for HS_AcquireWriteBuffer().
+    if(!Temp->LockFree){LeaveCriticalSection(&Temp->BuffersMutex);}
+    *Count = i;
     return FT_OK;
 }
 
 /*
-    Called by _QueueRequester, frees all buffers.
-    Overlaps must complete or pipes aborted. Otherwise freeing them is not valid.
+    Sets how many buffers _QueueRequester keeps posted. Wakes it in case the new depth lets it post more.
 */
-void _FreeBuffers(HS_Queue *Queue)
+HS_QD3XX_API FT_STATUS HS_SetQueueDepth(HS_QUEUE Queue, ULONG Depth)
 {
-    HS_Buffer *Temp = NULL;
-    EnterCriticalSection(&Queue->BuffersMutex);
-    if(Queue->Buffers){Temp = Queue->Buffers->Next;}
-    FT_AbortPipe(Queue->Handle,Queue->PipeID); //Abort the pipe.
-    while(Queue->Buffers) //While Queue->Buffers exists.
-    {
-        FT_ReleaseOverlapped(Queue->Handle, &Temp->Overlap); //Release the overlap.
-        free(Temp->Buffer); //Should exist.
-        if(Temp == Queue->Buffers){free(Temp); Queue->Buffers = NULL; break;} //Deleted all buffers.
-        Queue->Buffers->Prev = Temp->Next; //Using as placeholder. Prev no longer matters.
-        free(Temp); //Free Temp.
-        Temp = Queue->Buffers->Prev; //Temp = Temp->Next;
-    }
-    if(Queue->WriteStatus){Temp = Queue->WriteStatus->Next;}
-    while(Queue->WriteStatus) //While Queue->WriteStatus exists.
-    {
-        FT_ReleaseOverlapped(Queue->Handle, &Temp->Overlap); //Release the overlap.
-        free(Temp->Buffer); //Should exist.
-        if(Temp == Queue->WriteStatus){free(Temp); Queue->WriteStatus = NULL; break;} //Deleted all buffers.
-        Queue->WriteStatus->Prev = Temp->Next; //Using as placeholder. Prev no longer matters.
-        free(Temp); //Free Temp.
-        Temp = Queue->WriteStatus->Prev; //Temp = Temp->Next;
-    }
-    Queue->Size = 0;
-    LeaveCriticalSection(&Queue->BuffersMutex);
-    return;
+    if(!Queue){return FT_INVALID_PARAMETER;}
+    HS_Queue *Temp = Queue;
+    if((Depth < 1) || (Depth > Temp->QueueLength)){return FT_INVALID_PARAMETER;}
+    if(!Temp->LockFree){EnterCriticalSection(&Temp->BuffersMutex);}
+    HS_StoreRelaxed(&Temp->Depth, Depth);
+    _WakeRequester(Temp);
+    if(!Temp->LockFree){LeaveCriticalSection(&Temp->BuffersMutex);}
+    return FT_OK;
 }
 
 /*
-    Makes read/write pipe requests and fills the queue.
+    Sets the pipe timeout first, a queue whose pipe can't take it keeps its old StallMs.
+    The watchdog is started with the first StallMs and runs until HS_FreeQueueD3XX().
 */
-FT_STATUS _QueueRequester(HS_Queue *Queue)
+HS_QD3XX_API FT_STATUS HS_SetQueueTimeout(HS_QUEUE Queue, DWORD PipeTimeoutMs, ULONG StallMs)
 {
-    HS_Buffer *TempBuffer = NULL;
     FT_STATUS Status = FT_OK;
-    BOOL InPipe = Queue->PipeID & 0x80; //If true, we make read pipe requests.
-    while(TRUE)
+    if(!Queue){return FT_INVALID_PARAMETER;}
+    HS_Queue *Temp = Queue;
+    EnterCriticalSection(&QueueListMutex);
+    if(PipeTimeoutMs)
     {
-        if(TryEnterCriticalSection(&Queue->ActiveMutex))
-        {
-            if(!Queue->Active) //Main thread is telling us to stop.
-            {
-                LeaveCriticalSection(&Queue->ActiveMutex);
-                //Clear out the buffer!
-                _FreeBuffers(Queue);
-                return FT_OK; //Stop running.
-            }
-            LeaveCriticalSection(&Queue->ActiveMutex);
-        }
-        if(InPipe) //Make read pipe requests.
-        {
-            EnterCriticalSection(&Queue->BuffersMutex);
-            _AddBuffer(Queue, NULL, &TempBuffer, FALSE); //Add a buffer to the read pipe queue.
-            if(TempBuffer) //If a buffer was added, initiate the read pipe call for it.
-            {
-                #ifdef _WIN32
-                    TempBuffer->Status = FT_ReadPipe(Queue->Handle, Queue->PipeID,
-                #else
-                    TempBuffer->Status = FT_ReadPipeAsync(Queue->Handle, (Queue->PipeID&0x07)-2, //Linux uses FIFO ID.
-                #endif //_WIN32
-                                                    TempBuffer->Buffer, Queue->StreamSize,
-                                                    &TempBuffer->BytesTransferred, &TempBuffer->Overlap);
-            }
-            TempBuffer = NULL;
-            LeaveCriticalSection(&Queue->BuffersMutex);
-        }
-        else //Make write pipe requests.
-        {
-            EnterCriticalSection(&Queue->BuffersMutex);
-            if(Queue->Size) //If there's data to write out.
-            {
-                #ifdef _WIN32
-                    Queue->Buffers->Status = FT_WritePipe(Queue->Handle, Queue->PipeID,
-                #else
-                    Queue->Buffers->Status = FT_WritePipeAsync(Queue->Handle, (Queue->PipeID&0x07)-2, //Linux uses FIFO ID.
-                #endif //_WIN32
-                                                        Queue->Buffers->Buffer, Queue->StreamSize,
-                                                        &Queue->Buffers->BytesTransferred,&Queue->Buffers->Overlap);
-                LeaveCriticalSection(&Queue->BuffersMutex);
-                _RetrieveBuffer(Queue); //Decrement write queue and increment WriteStatus queue.
-            }
-            else
-            {
-                LeaveCriticalSection(&Queue->BuffersMutex);
-            }
-        }
+        if(!D3XX.SetPipeTimeout){Status = FT_NOT_SUPPORTED;} //Backend made before the entry existed.
+        else{Status = D3XX.SetPipeTimeout(Temp->Handle, Temp->PipeID, PipeTimeoutMs);}
+        if(Status == FT_OK){HS_StoreRelaxed(&Temp->PipeTimeoutMs, PipeTimeoutMs);} //_ReapBuffer() recovers its timeouts.
+    }
+    if((Status == FT_OK) && StallMs && !WatchdogThread)
+    {
+        WatchdogActive = TRUE;
+        WatchdogThread = _StartThread((PVOID)_WatchdogThread, NULL, &WatchdogThreadID);
+        if(!WatchdogThread){WatchdogActive = FALSE; Status = FT_NO_SYSTEM_RESOURCES;}
+    }
+    if(Status == FT_OK)
+    {
+        HS_StoreRelaxed64(&Temp->ProgressNs, _GetTimeNs()); //Don't count the time before the watchdog was on.
+        HS_StoreRelease(&Temp->StallMs, StallMs);
+        WakeConditionVariable(&WatchdogCond); //It may need to check sooner.
     }
+    LeaveCriticalSection(&QueueListMutex);
+    return Status;
 }
 
+BOOL _AbortReady(HS_Queue *Queue){return !HS_LoadAcquire(&Queue->AbortWanted);} //_WaitUser() condition.
+
 /*
-    Creates the thread for the queue.
+    Pausing is only a flag _CanPost() checks. Aborting is left to the queue's thread, which is the only one that
+    knows when it has stopped posting. The pipe is aborted here too in case the thread waits on an overlap.
 */
-FT_STATUS _CreateThread(HS_Queue *Queue)
+HS_QD3XX_API FT_STATUS HS_PauseQueue(HS_QUEUE Queue, ULONG Flags)
 {
+    BOOL Done = TRUE;
     if(!Queue){return FT_INVALID_PARAMETER;}
-    Queue->Active = TRUE; //Indicate Queue is active.
-    InitializeCriticalSection(&Queue->ActiveMutex);
-    InitializeCriticalSection(&Queue->BuffersMutex);
-    #ifdef _WIN32
-        Queue->ThreadHandle = CreateThread(NULL, 0, (PVOID)_QueueRequester, Queue, 0, &Queue->ThreadID);
-    #else
-        Queue->ThreadHandle = (HANDLE) malloc(sizeof(pthread_t));
-        if(Queue->ThreadHandle)
-        {
-            if(pthread_create(Queue->ThreadHandle, NULL, (PVOID)_QueueRequester, Queue))
-            {free(Queue->ThreadHandle); Queue->ThreadHandle = NULL;} //Failed to create thread.
-        }
-    #endif //_WIN32
-    if(!Queue->ThreadHandle) //If we failed to make a thread.
+    HS_Queue *Temp = Queue;
+    if(Flags & ~HS_PAUSE_ABORT){return FT_INVALID_PARAMETER;}
+    if(!Temp->LockFree){EnterCriticalSection(&Temp->BuffersMutex);}
+    HS_StoreRelease(&Temp->Paused, TRUE); //Before AbortWanted, the thread stops posting once it sees that.
+    if(Flags & HS_PAUSE_ABORT)
     {
-        Queue->Active = FALSE;
-        DeleteCriticalSection(&Queue->ActiveMutex);
-        DeleteCriticalSection(&Queue->BuffersMutex);
-        return FT_NO_SYSTEM_RESOURCES;
+        HS_StoreRelease(&Temp->AbortWanted, TRUE);
+        D3XX.AbortPipe(Temp->Handle, Temp->PipeID);
+        _WakeRequester(Temp);
+        Done = _WaitUser(Temp, _AbortReady, INFINITE); //Only fails if the queue is being destroyed.
     }
-    return FT_OK;
+    if(!Temp->LockFree){LeaveCriticalSection(&Temp->BuffersMutex);}
+    return Done ? FT_OK : FT_OPERATION_ABORTED;
 }
 
-//Returns version of the QueueD3XX library in hex. 0xAABBCCDD = Version AA.BB.CC.DD.
-ULONG HS_GetVersionQueueD3XX(){return (ULONG)QUEUE_D3XX_VERSION;}
+HS_QD3XX_API FT_STATUS HS_ResumeQueue(HS_QUEUE Queue)
+{
+    if(!Queue){return FT_INVALID_PARAMETER;}
+    HS_Queue *Temp = Queue;
+    if(!Temp->LockFree){EnterCriticalSection(&Temp->BuffersMutex);}
+    HS_StoreRelease(&Temp->Paused, FALSE);
+    _WakeRequester(Temp); //Queued buffers can be posted.
+    if(!Temp->LockFree){LeaveCriticalSection(&Temp->BuffersMutex);}
+    return FT_OK;
+}
 
 /*
-    Add a new Queue to the Queue list.
+    Gives every done buffer back like HS_ReadQueueBatch(), with one Head/RetTail store.
+    Queued writes are only touched when paused with nothing in flight, then the thread leaves Post to Tail alone.
+    A lock free thread can be posting as the pause lands, so it has to see the pause through AbortWanted first.
 */
-FT_STATUS AddQueue(FT_HANDLE Handle, UCHAR PipeID, ULONG StreamSize,ULONG QueueLength, PVOID NewQueueP)
+HS_QD3XX_API FT_STATUS HS_FlushQueue(HS_QUEUE Queue, PULONG Discarded)
 {
-    EnterCriticalSection(&QueueListMutex); //Wait until we can enter the queue list mutex.
-    FT_STATUS Status;
-    HS_Queue *Temp = QueueList;
-    if((StreamSize < 1) || (QueueLength < 1) || (!NewQueueP)){LeaveCriticalSection(&QueueListMutex); return FT_INVALID_PARAMETER;}
-    if(QueueList)
+    ULONG Head, Reap, Post, Tail, End, RetTail, Count = 0;
+    BOOL Queued;
+    if(!Queue){return FT_INVALID_PARAMETER;}
+    HS_Queue *Temp = Queue;
+    if(Temp->Callback){return FT_NOT_SUPPORTED;} //Reads go to the callback.
+    if(!Temp->LockFree){EnterCriticalSection(&Temp->BuffersMutex);}
+    Reap = HS_LoadAcquire(&Temp->Reap);
+    Post = HS_LoadAcquire(&Temp->Post);
+    Tail = HS_LoadAcquire(&Temp->Tail);
+    Queued = !(Temp->PipeID & 0x80) && HS_LoadAcquire(&Temp->Paused) && (Reap == Post) && (Post != Tail);
+    if(Queued && Temp->LockFree) //A write it was posting is aborted and queued again by _AbortInFlight().
     {
-        do
-        {
-            if((Temp->Handle == Handle) && (Temp->PipeID == PipeID))
-            {
-                LeaveCriticalSection(&QueueListMutex); return FT_RESERVED_PIPE;
-            } //Return if a queue already exists for the given pipe & handle.
-            Temp = Temp->Next;
-        }while(Temp != QueueList);
+        HS_StoreRelease(&Temp->AbortWanted, TRUE);
+        _WakeRequester(Temp);
+        if(!_WaitUser(Temp, _AbortReady, INFINITE)){return FT_OPERATION_ABORTED;} //Being destroyed.
+        Reap = HS_LoadAcquire(&Temp->Reap);
+        Post = HS_LoadAcquire(&Temp->Post);
+        Queued = (Reap == Post) && (Post != Tail); //Post can't move now.
     }
-    HS_Queue *NewQueue = malloc(sizeof(HS_Queue));
-    if(!NewQueue){LeaveCriticalSection(&QueueListMutex); return FT_NO_SYSTEM_RESOURCES;}
-    *((PVOID *)NewQueueP) = NewQueue;
-    NewQueue->Handle = Handle;
-    NewQueue->PipeID = PipeID;
-    NewQueue->StreamSize = StreamSize;
-    NewQueue->QueueLength = QueueLength;
-    NewQueue->Size = 0;
-    NewQueue->SizeWS = 0;
-    NewQueue->Active = FALSE;
-    NewQueue->Buffers = NULL;
-    NewQueue->WriteStatus = NULL;
-    NewQueue->Prev = NULL; NewQueue->Next = NULL;
-    if(!QueueList) //Create QueueList.
+    RetTail = Temp->RetTail;
+    End = Queued ? Tail : Reap; //Done buffers are Head to Reap, queued writes follow right after them.
+    for(Head = Temp->Head; Head != End; Head = _RingNext(Temp, Head))
     {
-        QueueList = NewQueue;
-        QueueList->Prev = NewQueue;
-        QueueList->Next = NewQueue;
+        Temp->Returned[_RingSlot(Temp, RetTail)] = Temp->Ring[_RingSlot(Temp, Head)];
+        RetTail = _RingNext(Temp, RetTail);
+        Count += 1;
     }
-    else
+    if(Queued) //Take the queued writes off the ring, it's empty at Post.
     {
-        //Insert NewQueue into QueueList as last item.
-        QueueList->Prev->Next = NewQueue;
-        NewQueue->Next = QueueList;
-        NewQueue->Prev = QueueList->Prev;
-        QueueList->Prev = NewQueue;
+        HS_StoreRelease(&Temp->Tail, Post);
+        Head = Post;
     }
-    QueueSize += 1;
-    Status = _CreateThread(NewQueue); //Create a new thread for the queue.
-    LeaveCriticalSection(&QueueListMutex);
-    if(Status != FT_OK){HS_DestroyQueue(NewQueue); return Status;}
-    return Status;
+    HS_StoreRelease(&Temp->Head, Head); //Free the ring slots before the buffers can be added again.
+    HS_StoreRelease(&Temp->RetTail, RetTail);
+    if(Temp->PipeID & 0x80){_WakeRequester(Temp);} //Space freed up for more read pipe calls.
+    else{_WakeUser(Temp);} //Space freed up for HS_AcquireWriteBuffer().
+    if(!Temp->LockFree){LeaveCriticalSection(&Temp->BuffersMutex);}
+    if(Discarded){*Discarded = Count;}
+    return FT_OK;
 }
 
 /*
-    Wrapper for FT_Create(). So you don't need to import the D3XX library additionally to get a handle.
+    Counts the buffers from Reap to Post. Reap is loaded first so a newer Post can't land behind it.
 */
-HS_QD3XX_API FT_STATUS HS_Open(PVOID pvArg,DWORD dwFlags,FT_HANDLE *pftHandle)
+HS_QD3XX_API FT_STATUS HS_GetQueueInFlight(HS_QUEUE Queue, PULONG InFlight)
 {
-    return FT_Create(pvArg, dwFlags, pftHandle);
+    ULONG Reap;
+    if((!Queue) || (!InFlight)){return FT_INVALID_PARAMETER;}
+    HS_Queue *Temp = Queue;
+    Reap = HS_LoadAcquire(&Temp->Reap);
+    *InFlight = _RingCount(Temp, Reap, HS_LoadAcquire(&Temp->Post));
+    return FT_OK;
 }
 
 /*
-    Wrapper for FT_Close(). So you don't need to import the D3XX library additionally to close a handle.
+    Gets the number of heap allocations the queue has made for its buffers.
 */
-HS_QD3XX_API FT_STATUS HS_Close(FT_HANDLE ftHandle)
+HS_QD3XX_API FT_STATUS HS_GetQueueAllocations(HS_QUEUE Queue, PULONG Allocations)
 {
-    return FT_Close(ftHandle);
+    if((!Queue) || (!Allocations)){return FT_INVALID_PARAMETER;}
+    HS_Queue *Temp = Queue;
+    EnterCriticalSection(&Temp->BuffersMutex);
+    *Allocations = Temp->Allocations;
+    LeaveCriticalSection(&Temp->BuffersMutex);
+    return FT_OK;
 }
 
-HS_QD3XX_API FT_STATUS HS_CreateQueue(FT_HANDLE Handle, UCHAR PipeID, ULONG StreamSize, ULONG QueueLength, BOOL Fixed, HS_QUEUE *NewQueueP)
+/*
+    Gets the queue's counters. Each is loaded on its own with a relaxed load, the queue keeps running.
+*/
+HS_QD3XX_API FT_STATUS HS_GetQueueStats(HS_QUEUE Queue, HS_QUEUE_STATS *Stats)
 {
-    FT_STATUS Status = FT_OK;
-    if(Fixed){Status = FT_SetStreamPipe(Handle, FALSE, FALSE, PipeID, StreamSize);}
-    else{Status = FT_ClearStreamPipe(Handle, FALSE, FALSE, PipeID);}
-    if(Status != FT_OK){return Status;}
-    Status = AddQueue(Handle, PipeID, StreamSize, QueueLength, NewQueueP);
-    return Status;
+    if((!Queue) || (!Stats)){return FT_INVALID_PARAMETER;}
+    HS_Queue *Temp = Queue;
+    Stats->Bytes = HS_LoadRelaxed64(&Temp->Stats.Bytes);
+    Stats->Transfers = HS_LoadRelaxed64(&Temp->Stats.Transfers);
+    Stats->ShortTransfers = HS_LoadRelaxed64(&Temp->Stats.ShortTransfers);
+    Stats->FailedTransfers = HS_LoadRelaxed64(&Temp->Stats.FailedTransfers);
+    Stats->FullCount = HS_LoadRelaxed64(&Temp->Stats.FullCount);
+    Stats->FullNs = HS_LoadRelaxed64(&Temp->Stats.FullNs);
+    Stats->WaitNs = HS_LoadRelaxed64(&Temp->Stats.WaitNs);
+    Stats->HighWater = HS_LoadRelaxed(&Temp->Stats.HighWater);
+    Stats->QueueLength = Temp->QueueLength;
+    Stats->Stalls = HS_LoadRelaxed64(&Temp->Stats.Stalls);
+    Stats->Recoveries = HS_LoadRelaxed64(&Temp->Stats.Recoveries);
+    Stats->LastError = HS_LoadRelaxed(&Temp->Stats.LastError);
+    return FT_OK;
 }
 
-HS_QD3XX_API FT_STATUS HS_DestroyQueue(HS_QUEUE DQueue)
+/*
+    Makes the queue's eventfd the first time it's asked for. Signals it right away in case reads/writes already finished.
+*/
+HS_QD3XX_API FT_STATUS HS_GetQueueEventFd(HS_QUEUE Queue, int *EventFd)
 {
-    EnterCriticalSection(&QueueListMutex);
-    HS_Queue *Temp = DQueue;
-    if(!DQueue){LeaveCriticalSection(&QueueListMutex); return FT_INVALID_PARAMETER;}
-    if(!QueueList){LeaveCriticalSection(&QueueListMutex); return FT_NO_MORE_ITEMS;}
-    if(Temp->Active) //Kill the queue's thread.
-    {
-        EnterCriticalSection(&Temp->ActiveMutex);
-        Temp->Active = FALSE; //Tell thread to stop.
-        LeaveCriticalSection(&Temp->ActiveMutex);
-        #ifdef _WIN32
-            WaitForSingleObject(Temp->ThreadHandle, INFINITE); //Wait for thread to stop.
-            CloseHandle(Temp->ThreadHandle); //Close the thread to free up resources.
-        #else
-            pthread_join(*((pthread_t *)Temp->ThreadHandle), NULL);
-            free(Temp->ThreadHandle); Temp->ThreadHandle = NULL;
-        #endif //_WIN32
-    }
-    if(QueueSize == 1)
-    {
-        free(QueueList);
-        QueueList = NULL;
-    }
-    else
+    if((!Queue) || (!EventFd)){return FT_INVALID_PARAMETER;}
+    HS_Queue *Temp = Queue;
+    *EventFd = -1;
+    if(Temp->Callback){return FT_NOT_SUPPORTED;} //Reads go to the callback.
+    #ifdef _WIN32
+        return FT_NOT_SUPPORTED;
+    #else
+        int Fd;
+        EnterCriticalSection(&Temp->BuffersMutex);
+        Fd = Temp->EventFd;
+        if(Fd < 0)
+        {
+            Fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if(Fd < 0){LeaveCriticalSection(&Temp->BuffersMutex); return FT_NO_SYSTEM_RESOURCES;}
+            HS_StoreRelease(&Temp->EventFd, Fd); //_QueueRequester starts signalling it.
+            _SignalEventFd(Temp);
+        }
+        LeaveCriticalSection(&Temp->BuffersMutex);
+        *EventFd = Fd;
+        return FT_OK;
+    #endif //_WIN32
+}
+
+/*
+    Returns the mask of queues with a finished read/write the user hasn't taken.
+*/
+ULONG _ReadyMask(HS_Queue **Queues, ULONG Count)
+{
+    ULONG i, Mask = 0;
+    for(i = 0; i < Count; ++i)
     {
-        if(Temp == QueueList){QueueList = Temp->Next;}
-        Temp->Prev->Next = Temp->Next;
-        Temp->Next->Prev = Temp->Prev;
-        free(Temp);
+        if(HS_LoadRelaxed(&Queues[i]->Head) != HS_LoadAcquire(&Queues[i]->Reap)){Mask |= 1U << i;}
     }
-    QueueSize -= 1;
-    LeaveCriticalSection(&QueueListMutex);
-    return FT_OK;
+    return Mask;
 }
 
 /*
-    Copies data read from queue to ReadBuffer.
-    Fails if queue is for an OUT pipe.
-    Will destroy the queue if the pipe has been aborted and needs to undergo the abort procedure.
+    Hooks a waiter into every queue, then sleeps on it until a queue's _WakeUser() wakes it or time runs out.
+    Queues are checked under the waiter's Mutex, which _WakeWaiters() takes to wake it, so no wake up is missed.
 */
-HS_QD3XX_API FT_STATUS HS_ReadQueue(HS_QUEUE *Queue, PUCHAR ReadBuffer, PULONG BytesTransferred, BOOL Wait)
+HS_QD3XX_API FT_STATUS HS_WaitAny(HS_QUEUE *Queues, ULONG Count, DWORD Timeout, PULONG ReadyMask)
 {
-    FT_STATUS Status;
-    if((!Queue) || (!ReadBuffer) || (!BytesTransferred)){return FT_INVALID_PARAMETER;}
-    if(!(*Queue)){return FT_INVALID_PARAMETER;}
-    HS_Queue *Temp = *Queue;
-    HS_Buffer *TempBuffer = NULL;
-    if(!(Temp->PipeID & 0x80)){return FT_INVALID_PARAMETER;} //Return if queue is for a OUT pipe.
-    EnterCriticalSection(&Temp->BuffersMutex);
-    while(Temp->Size < 1)
+    ULONG i, Mask;
+    ULONGLONG Deadline, Now;
+    HS_Queue **Temp = (HS_Queue **)Queues;
+    HS_Waiter Waiter;
+    HS_WaitNode Nodes[HS_WAIT_ANY_MAX];
+    if((!Queues) || (!ReadyMask) || (!Count) || (Count > HS_WAIT_ANY_MAX)){return FT_INVALID_PARAMETER;}
+    *ReadyMask = 0;
+    for(i = 0; i < Count; ++i){if((!Temp[i]) || Temp[i]->Callback){return FT_INVALID_PARAMETER;}}
+    Mask = _ReadyMask(Temp, Count);
+    if(Mask || !Timeout) //Fast path, no lock needed.
     {
-        LeaveCriticalSection(&Temp->BuffersMutex);
-        if(!Wait){return FT_NO_MORE_ITEMS;}
-        EnterCriticalSection(&Temp->BuffersMutex);
+        *ReadyMask = Mask;
+        return Mask ? FT_OK : FT_TIMEOUT;
     }
-    TempBuffer = Temp->Buffers; //Get oldest buffer in queue.
-    LeaveCriticalSection(&Temp->BuffersMutex);
-    if((TempBuffer->Status != FT_IO_PENDING) && (TempBuffer->Status != FT_OK))
-    { //If the read pipe call failed, destroy the queue.
-        Status = TempBuffer->Status; //Keep status.
-        *Queue = NULL; //Set the Queue to NULL so the user doesn't try to use it.
-        HS_DestroyQueue(Temp); //Destroy the queue.
-        return Status;
+    Deadline = _GetDeadline(_GetTimeNs(), Timeout);
+    InitializeCriticalSection(&Waiter.Mutex);
+    InitializeConditionVariable(&Waiter.Cond);
+    for(i = 0; i < Count; ++i) //Get woken by every queue.
+    {
+        Nodes[i].Waiter = &Waiter;
+        Nodes[i].Prev = NULL;
+        EnterCriticalSection(&Temp[i]->BuffersMutex);
+        Nodes[i].Next = Temp[i]->Waiters;
+        if(Temp[i]->Waiters){Temp[i]->Waiters->Prev = &Nodes[i];}
+        Temp[i]->Waiters = &Nodes[i];
+        HS_FetchAdd(&Temp[i]->AnyWaiting, 1); //Tell lock free _WakeUser() to take the lock.
+        LeaveCriticalSection(&Temp[i]->BuffersMutex);
     }
-    Status = FT_GetOverlappedResult(Temp->Handle, &TempBuffer->Overlap,
-                                    &TempBuffer->BytesTransferred, Wait); //Wait for result.
-    *BytesTransferred = TempBuffer->BytesTransferred; //Set bytes transferred.
-    memcpy(ReadBuffer, TempBuffer->Buffer, TempBuffer->BytesTransferred);
-    if(Status == FT_OK)
+    HS_Fence();
+    EnterCriticalSection(&Waiter.Mutex);
+    while(!(Mask = _ReadyMask(Temp, Count)))
     {
-        _DestroyBuffer(Temp);
-        return FT_OK;
+        if(!Deadline){SleepConditionVariableCS(&Waiter.Cond, &Waiter.Mutex, INFINITE); continue;}
+        Now = _GetTimeNs();
+        if(Now >= Deadline){break;}
+        SleepConditionVariableCS(&Waiter.Cond, &Waiter.Mutex, (DWORD)((Deadline - Now + 999999ULL) / 1000000ULL));
     }
-    if((Status != FT_IO_INCOMPLETE) && (Status != FT_IO_PENDING))
+    LeaveCriticalSection(&Waiter.Mutex);
+    for(i = 0; i < Count; ++i) //Unhook before Waiter goes away.
     {
-        *Queue = NULL; //Set the Queue to NULL so the user doesn't try to use it.
-        HS_DestroyQueue(Temp); //Destroy the queue.
+        EnterCriticalSection(&Temp[i]->BuffersMutex);
+        if(Nodes[i].Prev){Nodes[i].Prev->Next = Nodes[i].Next;}
+        else{Temp[i]->Waiters = Nodes[i].Next;}
+        if(Nodes[i].Next){Nodes[i].Next->Prev = Nodes[i].Prev;}
+        HS_FetchAdd(&Temp[i]->AnyWaiting, (ULONG)-1);
+        LeaveCriticalSection(&Temp[i]->BuffersMutex);
     }
-    return Status;
+    DeleteCriticalSection(&Waiter.Mutex);
+    DeleteConditionVariable(&Waiter.Cond);
+    *ReadyMask = Mask;
+    return Mask ? FT_OK : FT_TIMEOUT;
 }
 
 /*
-    Copies data from WriteBuffer to queue.
-    Fails if queue is for an IN pipe.
-    Returns FT_BUSY if the queue is full.
-    If Wait is true, HS_WriteQueue() won't return until WriteBuffer is copied into the queue.
+    Copies a latency histogram of a HS_QUEUE_TIMING queue with relaxed loads, the queue keeps running.
 */
-HS_QD3XX_API FT_STATUS HS_WriteQueue(HS_QUEUE Queue, PUCHAR WriteBuffer, BOOL Wait)
+HS_QD3XX_API FT_STATUS HS_GetQueueLatency(HS_QUEUE Queue, ULONG Stage, HS_LATENCY_HISTOGRAM *Histogram)
 {
-    FT_STATUS Status;
-    if((!Queue) || (!WriteBuffer)){return FT_INVALID_PARAMETER; }
+    ULONG i;
+    if((!Queue) || (!Histogram) || (Stage >= HS_LATENCY_STAGES)){return FT_INVALID_PARAMETER;}
     HS_Queue *Temp = Queue;
-    if(Temp->PipeID & 0x80){return FT_INVALID_PARAMETER;} //Return if queue is for an IN pipe.
-    HS_Buffer *TempBuffer = NULL;
-    PUCHAR NewBuffer = malloc(Temp->StreamSize); //Allocate buffer to hold WriteBuffer data.
-    if(!NewBuffer){return FT_NO_SYSTEM_RESOURCES;} //Failed to allocate memory.
-    memcpy(NewBuffer, WriteBuffer, Temp->StreamSize); //Copy data.
-    while(!TempBuffer)
+    HS_LATENCY_HISTOGRAM *Source = NULL;
+    if(!Temp->Latency){return FT_NOT_SUPPORTED;} //Not made with HS_QUEUE_TIMING.
+    Source = &Temp->Latency[Stage];
+    Histogram->Count = 0;
+    for(i = 0; i < HS_LATENCY_BUCKETS; ++i)
     {
-        Status = _AddBuffer(Temp, NewBuffer, &TempBuffer, TRUE); //Add NewBuffer to queue.
-        if(!Wait & !TempBuffer){free(NewBuffer); break;} //If we're not waiting, free the buffer and break.
+        Histogram->Buckets[i] = HS_LoadRelaxed64(&Source->Buckets[i]);
+        Histogram->Count += Histogram->Buckets[i];
     }
-    return Status;
+    Histogram->TotalNs = HS_LoadRelaxed64(&Source->TotalNs);
+    Histogram->MaxNs = HS_LoadRelaxed64(&Source->MaxNs);
+    return FT_OK;
 }
 
 /*
-    Get the status of the oldest write in the queue.
+    Walks the buckets up to Percentile of Count and returns the end of the bucket it lands in.
 */
-HS_QD3XX_API FT_STATUS HS_GetWriteStatus(HS_QUEUE *Queue, PULONG BytesTransferred, BOOL Wait)
+HS_QD3XX_API ULONGLONG HS_GetLatencyPercentile(const HS_LATENCY_HISTOGRAM *Histogram, double Percentile)
 {
-    FT_STATUS Status;
-    if((!Queue) || (!BytesTransferred)){return FT_INVALID_PARAMETER;}
-    if(!(*Queue)){return FT_INVALID_PARAMETER;}
-    HS_Queue *Temp = *Queue;
-    HS_Buffer *TempBuffer = NULL;
-    if(Temp->PipeID & 0x80){return FT_INVALID_PARAMETER;} //Return if queue is for an IN pipe.
-    do
+    ULONG i, Shift;
+    ULONGLONG Target, Seen = 0, End;
+    if((!Histogram) || (!Histogram->Count)){return 0;}
+    if(Percentile < 0.0){Percentile = 0.0;}
+    if(Percentile > 100.0){Percentile = 100.0;}
+    Target = (ULONGLONG)((double)Histogram->Count * Percentile / 100.0 + 0.999999); //Round up to a whole value.
+    if(!Target){Target = 1;}
+    for(i = 0; i < HS_LATENCY_BUCKETS; ++i)
     {
-        EnterCriticalSection(&Temp->BuffersMutex);
-        if(!Temp->SizeWS) //If no write pipe calls have happened.
-        {
-            Status = Temp->Size ? FT_IO_PENDING : FT_NO_MORE_ITEMS;
-            //^No writes have been queued up or we're waiting for a write to happen.
-        }
-        else
-        {
-            Status = FT_OK; //Write call has happened, we can now get overlap.
-            LeaveCriticalSection(&Temp->BuffersMutex);
-            break;
-        }
-        LeaveCriticalSection(&Temp->BuffersMutex);
-    }while(Wait && (Status != FT_NO_MORE_ITEMS));
-    if(Status == FT_OK) //Temp->WriteStatus exists.
+        Seen += Histogram->Buckets[i];
+        if(Seen >= Target){break;}
+    }
+    if(i >= HS_LATENCY_BUCKETS - 1){return Histogram->MaxNs;} //The last bucket has no end.
+    if(i < (2U << HS_LATENCY_SUB_BITS)){End = i;} //Buckets this small are one value wide.
+    else
     {
-        EnterCriticalSection(&Temp->BuffersMutex);
-        TempBuffer = Temp->WriteStatus;
-        LeaveCriticalSection(&Temp->BuffersMutex);
-        do
-        {
-            Status = FT_GetOverlappedResult(Temp->Handle, &TempBuffer->Overlap,
-                                                            &TempBuffer->BytesTransferred, FALSE);
-        }while(Wait && (Status != FT_OK));
-        *BytesTransferred = TempBuffer->BytesTransferred;
-        if(Status == FT_OK) //Destroy buffer as we got its status.
-        {
-            EnterCriticalSection(&Temp->BuffersMutex);
-            if(Temp->SizeWS == 1)
-            {
-                free(Temp->WriteStatus->Buffer);
-                free(Temp->WriteStatus);
-                Temp->WriteStatus = NULL;
-            }
-            else //More than one buffer exists.
-            {
-                if(TempBuffer == Temp->WriteStatus){Temp->WriteStatus = TempBuffer->Next;}
-                TempBuffer->Prev->Next = TempBuffer->Next;
-                TempBuffer->Next->Prev = TempBuffer->Prev;
-                free(TempBuffer->Buffer);
-                free(TempBuffer);
-            }
-            Temp->SizeWS -= 1;
-            LeaveCriticalSection(&Temp->BuffersMutex);
-            return FT_OK;
-        }
-        if((Status != FT_IO_INCOMPLETE) && (Status != FT_IO_PENDING))
-        {
-            *Queue = NULL; //Set the Queue to NULL so the user doesn't try to use it.
-            HS_DestroyQueue(Temp); //Destroy the queue.
-        }
+        Shift = (i >> HS_LATENCY_SUB_BITS) - 1;
+        End = ((((ULONGLONG)i & ((1U << HS_LATENCY_SUB_BITS) - 1)) + (1U << HS_LATENCY_SUB_BITS) + 1) << Shift) - 1;
     }
-    return Status;
+    return (End < Histogram->MaxNs) ? End : Histogram->MaxNs;
+}
+
+/*
+    Makes the library call Backend instead of the D3XX library. NULL goes back to the D3XX library.
+    Fails with FT_BUSY while any queue exists.
+*/
+HS_QD3XX_API FT_STATUS HS_SetBackend(const HS_D3XX_BACKEND *Backend)
+{
+    if(Backend && (!Backend->Create || !Backend->Close || !Backend->ReadPipe || !Backend->WritePipe ||
+                   !Backend->GetOverlappedResult || !Backend->InitializeOverlapped || !Backend->ReleaseOverlapped ||
+                   !Backend->SetStreamPipe || !Backend->ClearStreamPipe || !Backend->AbortPipe))
+    {
+        return FT_INVALID_PARAMETER;
+    }
+    EnterCriticalSection(&QueueListMutex);
+    if(QueueSize){LeaveCriticalSection(&QueueListMutex); return FT_BUSY;} //Queues are using the current backend.
+    D3XX = Backend ? *Backend : HS_DEFAULT_BACKEND;
+    LeaveCriticalSection(&QueueListMutex);
+    return FT_OK;
+}
+
+/*
+    Gets the backend the library is calling, so a new backend can wrap it.
+*/
+HS_QD3XX_API FT_STATUS HS_GetBackend(HS_D3XX_BACKEND *Backend)
+{
+    if(!Backend){return FT_INVALID_PARAMETER;}
+    EnterCriticalSection(&QueueListMutex);
+    *Backend = D3XX;
+    LeaveCriticalSection(&QueueListMutex);
+    return FT_OK;
 }
 
 HS_QD3XX_API FT_STATUS HS_FreeQueueD3XX()
@@ -5,5 +5,10 @@
 
 void _InitQueueList();
 void _FreeQueueList();
+void _StopWatchdog();
+ULONGLONG _GetTimeNs();
+
+extern HS_D3XX_BACKEND D3XX; //Backend the library calls, see HS_SetBackend().
+extern const HS_D3XX_BACKEND SimBackend; //Simulated device from HS_SimD3XX.c.
 
 #endif // !_HS_QUEUED3XX_H
@@ -0,0 +1,270 @@
+/*
+    Created By: Hector Soto
+    A simulated FT60x for testing and benchmarking without hardware, installed by HS_UseSimD3XX().
+    Transfers finish after their bytes go through the pipe's bandwidth plus latency and jitter.
+*/
+#ifdef _WIN32
+    #include "pch.h"
+#else //For Linux/macOS
+    #include "HS_processthreadsapi.h"
+#endif //_WIN32
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "QueueD3XX.h"
+#include "HS_QueueD3XX.h"
+#include "HS_Atomics.h"
+
+#define HS_SIM_PIPES 8 //OUT pipes 0x02 to 0x05 then IN pipes 0x82 to 0x85.
+#define HS_SIM_ABORTS 16 //Abort times kept per pipe, enough for the aborts made while a transfer is in flight.
+
+typedef struct _HS_SimPipe{
+    ULONG Epoch; //Bumped by aborts. Overlaps posted before an abort finish as aborted.
+    ULONG PostEpoch; //Epoch when BusyUntil was last set. Only used by the thread posting to the pipe.
+    ULONGLONG BusyUntil; //When the pipe is done sending what was posted so far. Only used by the posting thread.
+    ULONG Transfers; //Transfers posted, used to pick short transfers and errors. Only used by the posting thread.
+    ULONG Random; //Jitter state. Only used by the posting thread.
+    ULONGLONG Reads; //Written into the start of each read. Only used by the posting thread.
+    ULONG TimeoutMs; //From _SimSetPipeTimeout(), transfers taking longer fail with FT_TIMEOUT. 0 is none.
+    ULONGLONG AbortNs[HS_SIM_ABORTS]; //When the abort that began each epoch was made, by Epoch % HS_SIM_ABORTS.
+} HS_SimPipe;
+
+typedef struct _HS_SimDevice{
+    HS_SIM_CONFIG Config;
+    HS_SimPipe Pipes[HS_SIM_PIPES];
+} HS_SimDevice;
+
+HS_SIM_CONFIG SimConfig; //Copied into each device when it's opened.
+
+/*
+    Returns the pipe of a simulated device or NULL if PipeID isn't one.
+*/
+HS_SimPipe *_SimPipe(FT_HANDLE Handle, UCHAR PipeID)
+{
+    UCHAR Index = (PipeID & 0x7F) - 2;
+    if(!Handle || (Index > 3)){return NULL;}
+    return &((HS_SimDevice *)Handle)->Pipes[Index + ((PipeID & 0x80) ? 4 : 0)];
+}
+
+/*
+    Sleeps for at most Ns nanoseconds, short enough to notice aborts.
+*/
+void _SimSleep(ULONGLONG Ns)
+{
+    #ifdef _WIN32
+        if(Ns >= 2000000ULL){Sleep(1);}
+        else{SwitchToThread();}
+    #else
+        struct timespec Time;
+        Time.tv_sec = 0;
+        Time.tv_nsec = (long)((Ns < 1000000ULL) ? Ns : 1000000ULL);
+        nanosleep(&Time, NULL);
+    #endif //_WIN32
+}
+
+/*
+    Returns how many devices the device info list has.
+*/
+ULONG _SimDevices(){return SimConfig.Devices ? SimConfig.Devices : 1;}
+
+/*
+    Writes the serial number of device Index, "SIM" and the index.
+*/
+void _SimSerial(ULONG Index, char *Serial, size_t Size)
+{
+    snprintf(Serial, Size, "SIM%lu", (unsigned long)Index);
+}
+
+FT_STATUS _SimCreate(PVOID Arg, DWORD Flags, FT_HANDLE *Handle)
+{
+    ULONG i;
+    char Serial[16];
+    HS_SimDevice *Device = NULL;
+    if(!Handle){return FT_INVALID_PARAMETER;}
+    if(Flags == FT_OPEN_BY_SERIAL_NUMBER) //Any index opens, serials must be listed.
+    {
+        if(!Arg){return FT_INVALID_PARAMETER;}
+        for(i = 0; i < _SimDevices(); ++i)
+        {
+            _SimSerial(i, Serial, sizeof(Serial));
+            if(!strcmp(Serial, (const char *)Arg)){break;}
+        }
+        if(i == _SimDevices()){return FT_DEVICE_NOT_FOUND;}
+    }
+    Device = malloc(sizeof(HS_SimDevice));
+    if(!Device){return FT_INSUFFICIENT_RESOURCES;}
+    memset(Device, 0, sizeof(HS_SimDevice));
+    Device->Config = SimConfig;
+    for(i = 0; i < HS_SIM_PIPES; ++i){Device->Pipes[i].Random = (SimConfig.Seed + i) * 2654435761U + 1;} //Never 0.
+    *Handle = (FT_HANDLE)Device;
+    return FT_OK;
+}
+
+FT_STATUS _SimClose(FT_HANDLE Handle)
+{
+    if(!Handle){return FT_INVALID_HANDLE;}
+    free(Handle);
+    return FT_OK;
+}
+
+/*
+    Works out when a transfer finishes and keeps it in the overlap until _SimGetOverlappedResult().
+    Internal is the status, InternalHigh the bytes, Offset/OffsetHigh the finish time and hEvent the pipe & epoch.
+*/
+FT_STATUS _SimPost(FT_HANDLE Handle, UCHAR PipeID, PUCHAR Buffer, ULONG Length, PULONG BytesTransferred, LPOVERLAPPED Overlapped)
+{
+    HS_SimDevice *Device = (HS_SimDevice *)Handle;
+    HS_SimPipe *Pipe = _SimPipe(Handle, PipeID);
+    HS_SIM_CONFIG *Config = NULL;
+    FT_STATUS Status = FT_OK;
+    ULONG Bytes = Length, Epoch, TimeoutMs;
+    ULONGLONG Posted, Start, Done;
+    if(!Pipe || !Buffer || !BytesTransferred || !Overlapped){return FT_INVALID_PARAMETER;}
+    Config = &Device->Config;
+    *BytesTransferred = 0;
+    Epoch = HS_LoadAcquire(&Pipe->Epoch);
+    if(Pipe->PostEpoch != Epoch){Pipe->PostEpoch = Epoch; Pipe->BusyUntil = 0;} //Aborted transfers don't hold up the pipe.
+    Pipe->Transfers += 1;
+    if(Config->ShortEvery && !(Pipe->Transfers % Config->ShortEvery) && (Config->ShortLength < Bytes)){Bytes = Config->ShortLength;}
+    if(Config->ErrorEvery && !(Pipe->Transfers % Config->ErrorEvery)){Status = Config->ErrorStatus; Bytes = 0;}
+    Posted = _GetTimeNs();
+    Start = Posted;
+    if(Pipe->BusyUntil > Start){Start = Pipe->BusyUntil;} //Wait for the transfers before us.
+    if(Config->BytesPerSecond){Start += (ULONGLONG)Bytes * 1000000000ULL / Config->BytesPerSecond;}
+    Pipe->BusyUntil = Start;
+    Done = Start + (ULONGLONG)Config->LatencyUs * 1000ULL;
+    if(Config->JitterUs)
+    {
+        Pipe->Random ^= Pipe->Random << 13; Pipe->Random ^= Pipe->Random >> 17; Pipe->Random ^= Pipe->Random << 5;
+        Done += (ULONGLONG)(Pipe->Random % (Config->JitterUs + 1)) * 1000ULL;
+    }
+    if(Config->StallEvery && !(Pipe->Transfers % Config->StallEvery)){Done = ~0ULL;} //Only an abort ends it.
+    TimeoutMs = HS_LoadRelaxed(&Pipe->TimeoutMs);
+    if(TimeoutMs && ((Done - Posted) > (ULONGLONG)TimeoutMs * 1000000ULL))
+    {
+        Done = Posted + (ULONGLONG)TimeoutMs * 1000000ULL;
+        Status = FT_TIMEOUT; Bytes = 0;
+    }
+    if(PipeID & 0x80) //Stamp reads so users can check for drops and measure latency.
+    {
+        if(Bytes >= sizeof(ULONGLONG)){memcpy(Buffer, &Pipe->Reads, sizeof(ULONGLONG));}
+        if(Bytes >= 2 * sizeof(ULONGLONG)){memcpy(Buffer + sizeof(ULONGLONG), &Done, sizeof(ULONGLONG));}
+        Pipe->Reads += 1;
+    }
+    Overlapped->Internal = Status;
+    Overlapped->InternalHigh = Bytes;
+    Overlapped->Offset = (DWORD)Done;
+    Overlapped->OffsetHigh = (DWORD)(Done >> 32);
+    Overlapped->hEvent = (HANDLE)(size_t)(((Epoch & 0xFFFFFF) << 8) | (ULONG)(Pipe - Device->Pipes));
+    return FT_IO_PENDING;
+}
+
+FT_STATUS _SimGetOverlappedResult(FT_HANDLE Handle, LPOVERLAPPED Overlapped, PULONG BytesTransferred, BOOL Wait)
+{
+    HS_SimPipe *Pipe = NULL;
+    ULONG Epoch;
+    ULONGLONG Done, Now;
+    if(!Handle || !Overlapped || !BytesTransferred){return FT_INVALID_PARAMETER;}
+    Pipe = &((HS_SimDevice *)Handle)->Pipes[(size_t)Overlapped->hEvent & 0xFF];
+    Epoch = (ULONG)((size_t)Overlapped->hEvent >> 8);
+    Done = ((ULONGLONG)Overlapped->OffsetHigh << 32) | Overlapped->Offset;
+    while(1)
+    {
+        if((HS_LoadAcquire(&Pipe->Epoch) & 0xFFFFFF) != Epoch) //Transfers done before the abort keep their result.
+        {
+            if(Done > HS_LoadRelaxed64(&Pipe->AbortNs[(Epoch + 1) % HS_SIM_ABORTS])){*BytesTransferred = 0; return FT_OPERATION_ABORTED;}
+            break;
+        }
+        Now = _GetTimeNs();
+        if(Now >= Done){break;}
+        if(!Wait){return FT_IO_INCOMPLETE;}
+        _SimSleep(Done - Now);
+    }
+    *BytesTransferred = (ULONG)Overlapped->InternalHigh;
+    return (FT_STATUS)Overlapped->Internal;
+}
+
+FT_STATUS _SimInitializeOverlapped(FT_HANDLE Handle, LPOVERLAPPED Overlapped)
+{
+    if(!Handle || !Overlapped){return FT_INVALID_PARAMETER;}
+    memset(Overlapped, 0, sizeof(OVERLAPPED));
+    return FT_OK;
+}
+
+FT_STATUS _SimReleaseOverlapped(FT_HANDLE Handle, LPOVERLAPPED Overlapped){return Overlapped ? FT_OK : FT_INVALID_PARAMETER;}
+
+FT_STATUS _SimSetStreamPipe(FT_HANDLE Handle, BOOL AllWritePipes, BOOL AllReadPipes, UCHAR PipeID, ULONG StreamSize)
+{
+    if(AllWritePipes || AllReadPipes){return Handle ? FT_OK : FT_INVALID_HANDLE;}
+    return _SimPipe(Handle, PipeID) ? FT_OK : FT_INVALID_PARAMETER;
+}
+
+FT_STATUS _SimClearStreamPipe(FT_HANDLE Handle, BOOL AllWritePipes, BOOL AllReadPipes, UCHAR PipeID)
+{
+    return _SimSetStreamPipe(Handle, AllWritePipes, AllReadPipes, PipeID, 0);
+}
+
+FT_STATUS _SimAbortPipe(FT_HANDLE Handle, UCHAR PipeID)
+{
+    HS_SimPipe *Pipe = _SimPipe(Handle, PipeID);
+    if(!Pipe){return FT_INVALID_PARAMETER;}
+    HS_StoreRelaxed64(&Pipe->AbortNs[(HS_LoadAcquire(&Pipe->Epoch) + 1) % HS_SIM_ABORTS], _GetTimeNs());
+    HS_FetchAdd(&Pipe->Epoch, 1); //Everything posted so far and not done yet is aborted.
+    return FT_OK;
+}
+
+FT_STATUS _SimSetTransferParams(const HS_TRANSFER_CONFIG *Config, ULONG FifoID)
+{
+    if(!Config || (FifoID >= HS_FIFO_COUNT)){return FT_INVALID_PARAMETER;}
+    return FT_OK; //Simulated pipes have no URBs to size.
+}
+
+FT_STATUS _SimSetPipeTimeout(FT_HANDLE Handle, UCHAR PipeID, DWORD TimeoutMs)
+{
+    HS_SimPipe *Pipe = _SimPipe(Handle, PipeID);
+    if(!Pipe){return FT_INVALID_PARAMETER;}
+    HS_StoreRelaxed(&Pipe->TimeoutMs, TimeoutMs); //Applies to transfers posted after this.
+    return FT_OK;
+}
+
+FT_STATUS _SimCreateDeviceInfoList(LPDWORD NumDevices)
+{
+    if(!NumDevices){return FT_INVALID_PARAMETER;}
+    *NumDevices = _SimDevices();
+    return FT_OK;
+}
+
+FT_STATUS _SimGetDeviceInfoList(FT_DEVICE_LIST_INFO_NODE *List, LPDWORD NumDevices)
+{
+    ULONG i;
+    if(!List || !NumDevices){return FT_INVALID_PARAMETER;}
+    if(*NumDevices > _SimDevices()){*NumDevices = _SimDevices();}
+    for(i = 0; i < *NumDevices; ++i)
+    {
+        memset(&List[i], 0, sizeof(FT_DEVICE_LIST_INFO_NODE));
+        List[i].Type = FT_DEVICE_601;
+        List[i].ID = 0x0403601F; //FTDI's VID & the FT601's PID.
+        List[i].LocId = i + 1;
+        _SimSerial(i, List[i].SerialNumber, sizeof(List[i].SerialNumber));
+        strcpy(List[i].Description, "Simulated FT601");
+    }
+    return FT_OK;
+}
+
+const HS_D3XX_BACKEND SimBackend = {_SimCreate, _SimClose, _SimPost, _SimPost,
+                                    _SimGetOverlappedResult, _SimInitializeOverlapped, _SimReleaseOverlapped,
+                                    _SimSetStreamPipe, _SimClearStreamPipe, _SimAbortPipe,
+                                    _SimSetTransferParams, _SimSetPipeTimeout,
+                                    _SimCreateDeviceInfoList, _SimGetDeviceInfoList};
+
+/*
+    Makes the library use the simulated device. Devices opened after this use Config.
+*/
+HS_QD3XX_API FT_STATUS HS_UseSimD3XX(const HS_SIM_CONFIG *Config)
+{
+    FT_STATUS Status = HS_SetBackend(&SimBackend);
+    if(Status != FT_OK){return Status;}
+    if(Config){SimConfig = *Config;}
+    else{memset(&SimConfig, 0, sizeof(HS_SIM_CONFIG));}
+    return FT_OK;
+}
@@ -4,6 +4,8 @@
 */
 
 #include <pthread.h>
+#include <sched.h>
+#include <time.h>
 #include "Types.h"
 
 #define CRITICAL_SECTION pthread_mutex_t
@@ -11,4 +13,33 @@
 #define EnterCriticalSection pthread_mutex_lock
 #define TryEnterCriticalSection pthread_mutex_trylock
 #define LeaveCriticalSection pthread_mutex_unlock
-#define DeleteCriticalSection pthread_mutex_destroy
\ No newline at end of file
+#define DeleteCriticalSection pthread_mutex_destroy
+
+#define SwitchToThread sched_yield
+
+#define CONDITION_VARIABLE pthread_cond_t
+#define WakeConditionVariable pthread_cond_signal
+#define WakeAllConditionVariable pthread_cond_broadcast
+#define DeleteConditionVariable pthread_cond_destroy
+
+//Condition variables time out against the monotonic clock so wall clock changes don't affect waits.
+static inline void InitializeConditionVariable(pthread_cond_t *Cond)
+{
+    pthread_condattr_t Attr;
+    pthread_condattr_init(&Attr);
+    pthread_condattr_setclock(&Attr, CLOCK_MONOTONIC);
+    pthread_cond_init(Cond, &Attr);
+    pthread_condattr_destroy(&Attr);
+}
+
+//Same behaviour as the Windows call, returns FALSE if Milliseconds passed without a wake up.
+static inline BOOL SleepConditionVariableCS(pthread_cond_t *Cond, pthread_mutex_t *Mutex, DWORD Milliseconds)
+{
+    struct timespec Deadline;
+    if(Milliseconds == INFINITE){return !pthread_cond_wait(Cond, Mutex);}
+    clock_gettime(CLOCK_MONOTONIC, &Deadline);
+    Deadline.tv_sec += Milliseconds / 1000;
+    Deadline.tv_nsec += (long)(Milliseconds % 1000) * 1000000L;
+    if(Deadline.tv_nsec >= 1000000000L){Deadline.tv_sec += 1; Deadline.tv_nsec -= 1000000000L;}
+    return !pthread_cond_timedwait(Cond, Mutex, &Deadline);
+}
@@ -28,6 +28,126 @@
 
 typedef PVOID HS_QUEUE; //HS_Queue structure hidden within library to avoid user messing with it.
 
+#define HS_WRITE_PAD 0x01 //HS_WriteQueueEx() zero fills the buffer and writes out StreamSize bytes.
+
+#define HS_QUEUE_FIXED 0x01 //HS_CreateQueueEx() sets the pipe to fixed size transfers of StreamSize bytes.
+#define HS_QUEUE_LOCK_FREE 0x02 //HS_CreateQueueEx() hands buffers between the queue's thread and the user with atomics.
+#define HS_QUEUE_REACTOR 0x04 //HS_CreateQueueEx() shares one thread between every HS_QUEUE_REACTOR queue of a handle.
+#define HS_QUEUE_TIMING 0x08 //HS_CreateQueueEx() timestamps every transfer for HS_GetQueueLatency().
+#define HS_QUEUE_RECOVER 0x10 //HS_CreateQueueEx() makes a queue that reposts its transfers after one fails.
+
+#define HS_PAUSE_ABORT 0x01 //HS_PauseQueue() aborts the reads/writes in flight instead of letting them finish.
+
+#define HS_LATENCY_REQUESTER 0 //From a buffer being queued to its read/write pipe call, time spent waiting on the queue's thread.
+#define HS_LATENCY_DEVICE 1 //From the read/write pipe call to its overlap finishing, time spent in D3XX and on USB.
+#define HS_LATENCY_USER 2 //From the overlap finishing to the user getting the data/status, time spent waiting on the user.
+
+#define HS_WAIT_ANY_MAX 32 //Most queues HS_WaitAny() takes, one bit of ReadyMask each.
+
+#define HS_LATENCY_BUCKETS 592 //Buckets of HS_LATENCY_HISTOGRAM, covers up to 2^40 ns.
+
+/*
+	Called by a callback queue's thread for every finished read, see HS_CreateQueueWithCallback().
+	Data holds Length bytes and is only valid until the callback returns.
+*/
+typedef void (*HS_READ_CALLBACK)(PVOID Context, PUCHAR Data, ULONG Length, FT_STATUS Status);
+
+#define HS_FIFO_COUNT 4 //FIFO channels of a FT600/FT601, each has an OUT pipe 0x02+i and an IN pipe 0x82+i.
+
+#define HS_TRANSFER_NO_IN 0x01 //HS_TRANSFER_CONFIG Flags, the FIFO's IN pipe isn't used.
+#define HS_TRANSFER_NO_OUT 0x02 //HS_TRANSFER_CONFIG Flags, the FIFO's OUT pipe isn't used.
+#define HS_TRANSFER_SINGLE_THREAD 0x04 //HS_TRANSFER_CONFIG Flags, ignored. Pipes are aborted from other threads, D3XX must lock them.
+
+/*
+	Driver transfer settings of one FIFO for HS_OpenEx(). Values left 0 are derived from StreamSize and QueueLength,
+	or left at the driver's default if those are 0 too. Linux only, see FT_TRANSFER_CONF in ftd3xx.h.
+*/
+typedef struct _HS_TRANSFER_CONFIG{
+	ULONG StreamSize; //StreamSize the FIFO's queues will be created with.
+	ULONG QueueLength; //QueueLength the FIFO's queues will be created with.
+	ULONG URBCount; //URBs the driver keeps in flight per pipe, 2 to 255. 0 matches QueueLength.
+	ULONG URBBufferCount; //Buffers of the driver's read ring, 2 to 65535. 0 is the driver's default.
+	ULONG URBBufferSize; //Bytes per URB, 512 or more. 0 is StreamSize rounded up to a whole 1024 byte USB 3 packet.
+	ULONG StreamingSize; //Bytes the FT60x streams per request. 0 is the driver's default.
+	ULONG Flags; //HS_TRANSFER_ flags.
+} HS_TRANSFER_CONFIG;
+
+/*
+	D3XX calls the library makes, see HS_SetBackend(). Pipe calls are async and take pipe IDs on every platform.
+	Entries after AbortPipe are optional and can be NULL, the calls using them return FT_NOT_SUPPORTED.
+*/
+typedef struct _HS_D3XX_BACKEND{
+	FT_STATUS (*Create)(PVOID Arg, DWORD Flags, FT_HANDLE *Handle);
+	FT_STATUS (*Close)(FT_HANDLE Handle);
+	FT_STATUS (*ReadPipe)(FT_HANDLE Handle, UCHAR PipeID, PUCHAR Buffer, ULONG Length, PULONG BytesTransferred, LPOVERLAPPED Overlapped);
+	FT_STATUS (*WritePipe)(FT_HANDLE Handle, UCHAR PipeID, PUCHAR Buffer, ULONG Length, PULONG BytesTransferred, LPOVERLAPPED Overlapped);
+	FT_STATUS (*GetOverlappedResult)(FT_HANDLE Handle, LPOVERLAPPED Overlapped, PULONG BytesTransferred, BOOL Wait);
+	FT_STATUS (*InitializeOverlapped)(FT_HANDLE Handle, LPOVERLAPPED Overlapped);
+	FT_STATUS (*ReleaseOverlapped)(FT_HANDLE Handle, LPOVERLAPPED Overlapped);
+	FT_STATUS (*SetStreamPipe)(FT_HANDLE Handle, BOOL AllWritePipes, BOOL AllReadPipes, UCHAR PipeID, ULONG StreamSize);
+	FT_STATUS (*ClearStreamPipe)(FT_HANDLE Handle, BOOL AllWritePipes, BOOL AllReadPipes, UCHAR PipeID);
+	FT_STATUS (*AbortPipe)(FT_HANDLE Handle, UCHAR PipeID);
+	FT_STATUS (*SetTransferParams)(const HS_TRANSFER_CONFIG *Config, ULONG FifoID); //Applies to the next Create.
+	FT_STATUS (*SetPipeTimeout)(FT_HANDLE Handle, UCHAR PipeID, DWORD TimeoutMs);
+	FT_STATUS (*CreateDeviceInfoList)(LPDWORD NumDevices);
+	FT_STATUS (*GetDeviceInfoList)(FT_DEVICE_LIST_INFO_NODE *List, LPDWORD NumDevices);
+} HS_D3XX_BACKEND;
+
+/*
+	Settings of the simulated device from HS_UseSimD3XX(). All 0 makes every transfer finish right away.
+*/
+typedef struct _HS_SIM_CONFIG{
+	ULONGLONG BytesPerSecond; //Bandwidth of each pipe, 0 is unlimited.
+	ULONG LatencyUs; //Added to every transfer after its bytes are sent.
+	ULONG JitterUs; //Up to this much random latency is added on top of LatencyUs.
+	ULONG ShortEvery; //Every ShortEvery-th transfer of a pipe only moves ShortLength bytes. 0 never does.
+	ULONG ShortLength;
+	ULONG ErrorEvery; //Every ErrorEvery-th transfer of a pipe fails with ErrorStatus. 0 never does.
+	FT_STATUS ErrorStatus;
+	ULONG Seed; //Seed for the jitter.
+	ULONG StallEvery; //Every StallEvery-th transfer of a pipe never finishes, until aborted or the pipe times out. 0 never does.
+	ULONG Devices; //Devices in the device info list, 0 is 1. Their serial numbers are "SIM0", "SIM1" and so on.
+} HS_SIM_CONFIG;
+
+/*
+	Counters of a queue from HS_GetQueueStats(). They count from when the queue was created.
+*/
+typedef struct _HS_QUEUE_STATS{
+	ULONGLONG Bytes; //Bytes moved by transfers that finished with FT_OK.
+	ULONGLONG Transfers; //Transfers that finished with FT_OK, short ones included.
+	ULONGLONG ShortTransfers; //Transfers that finished with FT_OK but moved less than they asked for.
+	ULONGLONG FailedTransfers; //Transfers that finished with any other status.
+	ULONGLONG FullCount; //Times every buffer of the queue became in use.
+	ULONGLONG FullNs; //Nanoseconds spent with every buffer in use, added once space frees up.
+	ULONGLONG WaitNs; //Nanoseconds user calls spent sleeping on the queue.
+	ULONG HighWater; //Most buffers the queue has held at once, at most QueueLength.
+	ULONG QueueLength;
+	ULONGLONG Stalls; //Times the queue's pipe was aborted and its transfers posted again, see HS_SetQueueTimeout().
+	ULONGLONG Recoveries; //Times a failed transfer of a HS_QUEUE_RECOVER queue was recovered from.
+	FT_STATUS LastError; //Status of the last failed transfer recovered from, FT_OK if none.
+} HS_QUEUE_STATS;
+
+/*
+	One read of HS_ReadQueueBatch(). Buffer must hold StreamSize bytes.
+*/
+typedef struct _HS_READ_VEC{
+	PUCHAR Buffer;
+	ULONG BytesTransferred; //Set to the bytes copied into Buffer.
+} HS_READ_VEC;
+
+/*
+	Log-linear histogram of nanoseconds from HS_GetQueueLatency(). Buckets 0 to 31 count exactly 0 to 31 ns.
+	After that every power of two is split into 16 equal buckets, so a bucket is at most 1/16th of its values wide.
+	Bucket B >= 32 counts values from (16 + B % 16) << (B / 16 - 1) up to the next bucket. The last bucket also
+	counts everything above it.
+*/
+typedef struct _HS_LATENCY_HISTOGRAM{
+	ULONGLONG Count; //Values counted, the sum of Buckets.
+	ULONGLONG TotalNs; //Sum of every value, for the mean.
+	ULONGLONG MaxNs; //Largest value.
+	ULONGLONG Buckets[HS_LATENCY_BUCKETS];
+} HS_LATENCY_HISTOGRAM;
+
 /*
 	Returns version of the QueueD3XX library in hex. 0xAABBCCDD = Version AA.BB.CC.DD.
 */
@@ -38,6 +158,39 @@ HS_QD3XX_API ULONG HS_GetVersionQueueD3XX();
 */
 HS_QD3XX_API FT_STATUS HS_Open(PVOID pvArg, DWORD dwFlags, FT_HANDLE *pftHandle);
 
+/*
+	Same as HS_Open() but first applies FT_SetTransferParams() to each FIFO from PerFifo, an array of HS_FIFO_COUNT.
+	Give each FIFO the StreamSize and QueueLength its queues will use, the URBs are sized to match.
+	NULL PerFifo is the same as HS_Open(). The Windows driver sizes its own transfers and ignores PerFifo.
+*/
+HS_QD3XX_API FT_STATUS HS_OpenEx(PVOID Arg, DWORD Flags, const HS_TRANSFER_CONFIG *PerFifo, FT_HANDLE *Handle);
+
+/*
+	Enumerates the connected devices into the library's device list and sets Count to how many there are.
+	Call after devices are plugged in or come back from a USB reset.
+*/
+HS_QD3XX_API FT_STATUS HS_RefreshDevices(PULONG Count);
+
+/*
+	Gets a device from the list of the last HS_RefreshDevices(). Returns FT_DEVICE_NOT_FOUND past the end.
+*/
+HS_QD3XX_API FT_STATUS HS_GetDeviceInfo(ULONG Index, FT_DEVICE_LIST_INFO_NODE *Info);
+
+/*
+	Opens the device with serial number Serial. The device list is refreshed if it doesn't have Serial.
+*/
+HS_QD3XX_API FT_STATUS HS_OpenBySerial(const char *Serial, FT_HANDLE *Handle);
+
+/*
+	Opens Serial again after it was detached and reattached, moves every queue of Handle to the new handle
+	and closes Handle. Queues keep their HS_QUEUE, geometry, buffers, flags, pipe timeout and counters.
+	A handle from HS_OpenEx() is opened again with the same transfer params.
+	Held buffers are taken back and reads/writes not gotten yet are dropped. Don't use the queues until it returns.
+	If a queue can't be restarted, the first failure is returned and the queue is left detached: stopped, with its
+	buffers but no handle. Calls on it fail or find nothing, and it must be destroyed.
+*/
+HS_QD3XX_API FT_STATUS HS_ReattachDevice(FT_HANDLE Handle, const char *Serial, FT_HANDLE *NewHandle);
+
 /*
 	Wrapper for FT_Close(). So you don't need to import the D3XX library additionally to close a handle.
 */
@@ -45,11 +198,37 @@ HS_QD3XX_API FT_STATUS HS_Close(FT_HANDLE ftHandle);
 
 /*
 	Creates a queue for a pipe on a new thread that immediately starts reading/writing.
+	All QueueLength buffers of StreamSize bytes are allocated here and reused for the life of the queue.
 */
 HS_QD3XX_API FT_STATUS HS_CreateQueue(FT_HANDLE Handle, UCHAR PipeID, ULONG StreamSize, ULONG QueueLength, BOOL Fixed, HS_QUEUE *NewQueueP);
 
 /*
-	Destroys a queue and its running thread.
+	Same as HS_CreateQueue() but takes HS_QUEUE_ flags. HS_QUEUE_FIXED is the same as Fixed being TRUE.
+	HS_QUEUE_LOCK_FREE makes reads/writes that don't have to wait skip the queue's lock.
+	A lock free IN queue must only be read by one thread at a time, an OUT queue must only be written by one thread
+	and have its write status gotten by one thread (can be the same one).
+	HS_QUEUE_REACTOR queues of the same handle are serviced by one shared thread instead of a thread each.
+	The shared thread polls overlaps, so a lone transfer can take up to a millisecond longer to be seen.
+	HS_QUEUE_TIMING reads the clock four times per transfer to fill the histograms of HS_GetQueueLatency().
+	HS_QUEUE_RECOVER queues abort the pipe after a failed transfer and post it again with the others that didn't finish,
+	those that finished are kept in order. The user never sees the failure and the queue isn't destroyed. Recoveries and LastError in HS_QUEUE_STATS report them.
+	After a few recoveries in a row without a transfer finishing, the failure is handed to the user as usual.
+*/
+HS_QD3XX_API FT_STATUS HS_CreateQueueEx(FT_HANDLE Handle, UCHAR PipeID, ULONG StreamSize, ULONG QueueLength, ULONG Flags, HS_QUEUE *NewQueueP);
+
+/*
+	Creates a queue for an IN pipe whose thread calls Callback(Context, ...) for every finished read, in order.
+	The buffer is read into again once Callback returns, so up to QueueLength reads stay in flight while it runs.
+	Takes the same flags as HS_CreateQueueEx() except HS_QUEUE_REACTOR. The queue can't be read from.
+	After a read fails the queue stops reading, Callback gets the status of the reads still in flight and
+	the queue must then be destroyed. Callback must not destroy its own queue.
+*/
+HS_QD3XX_API FT_STATUS HS_CreateQueueWithCallback(FT_HANDLE Handle, UCHAR PipeID, ULONG StreamSize, ULONG QueueLength, ULONG Flags,
+												   HS_READ_CALLBACK Callback, PVOID Context, HS_QUEUE *NewQueueP);
+
+/*
+	Destroys a queue and its running thread. Queues of other pipes and handles can be made while it runs,
+	a new queue for the same pipe fails with FT_RESERVED_PIPE until it returns.
 */
 HS_QD3XX_API FT_STATUS HS_DestroyQueue(HS_QUEUE DQueue);
 
@@ -60,6 +239,33 @@ HS_QD3XX_API FT_STATUS HS_DestroyQueue(HS_QUEUE DQueue);
 */
 HS_QD3XX_API FT_STATUS HS_ReadQueue(HS_QUEUE *Queue, PUCHAR ReadBuffer, PULONG BytesTransferred, BOOL Wait);
 
+/*
+	Same as HS_ReadQueue() but waits up to Timeout milliseconds for a read to finish.
+	Returns FT_TIMEOUT if the time ran out. A Timeout of 0 acts like Wait = FALSE and INFINITE like Wait = TRUE.
+*/
+HS_QD3XX_API FT_STATUS HS_ReadQueueTimeout(HS_QUEUE *Queue, PUCHAR ReadBuffer, PULONG BytesTransferred, DWORD Timeout);
+
+/*
+	Points ReadBuffer at the oldest finished read in the queue instead of copying it.
+	The buffer belongs to the user until it is given back with HS_ReleaseReadBuffer(), and isn't read into meanwhile.
+	Held buffers count against QueueLength. Release every buffer before destroying the queue.
+	Timeout and failures behave like HS_ReadQueueTimeout().
+*/
+HS_QD3XX_API FT_STATUS HS_AcquireReadBuffer(HS_QUEUE *Queue, PUCHAR *ReadBuffer, PULONG BytesTransferred, DWORD Timeout);
+
+/*
+	Gives a buffer from HS_AcquireReadBuffer() back to the queue so it can be read into again.
+*/
+HS_QD3XX_API FT_STATUS HS_ReleaseReadBuffer(HS_QUEUE Queue, PUCHAR ReadBuffer);
+
+/*
+	Copies up to MaxCount finished reads into Reads in order, Count is set to how many were copied.
+	Waits up to Timeout milliseconds for the first read like HS_ReadQueueTimeout(), then takes every read that's done.
+	If a read failed after others were copied, those are returned with FT_OK and the next call fails with its status.
+	Held buffers from HS_AcquireReadBuffer() must be released before calling this.
+*/
+HS_QD3XX_API FT_STATUS HS_ReadQueueBatch(HS_QUEUE *Queue, HS_READ_VEC *Reads, ULONG MaxCount, PULONG Count, DWORD Timeout);
+
 /*
 	Copies data from WriteBuffer to queue.
 	Fails if queue is for an IN pipe.
@@ -68,12 +274,168 @@ HS_QD3XX_API FT_STATUS HS_ReadQueue(HS_QUEUE *Queue, PUCHAR ReadBuffer, PULONG B
 */
 HS_QD3XX_API FT_STATUS HS_WriteQueue(HS_QUEUE Queue, PUCHAR WriteBuffer, BOOL Wait);
 
+/*
+	Copies Length bytes from WriteBuffer to queue. Only Length bytes are written out unless Flags has HS_WRITE_PAD.
+	Length must be from 1 to StreamSize.
+	Returns FT_BUSY if the queue is full and Timeout is 0, FT_TIMEOUT if it stayed full for Timeout milliseconds.
+*/
+HS_QD3XX_API FT_STATUS HS_WriteQueueEx(HS_QUEUE Queue, PUCHAR WriteBuffer, ULONG Length, ULONG Flags, DWORD Timeout);
+
+/*
+	Copies as many of the Count buffers in WriteBuffers as fit into the queue in order, Accepted is set to how many did.
+	Lengths holds the bytes to write of each buffer, from 1 to StreamSize. NULL Lengths writes StreamSize bytes of each.
+	Waits up to Timeout milliseconds for room for the first buffer, then only takes what fits.
+	Returns FT_BUSY if the queue is full and Timeout is 0, FT_TIMEOUT if it stayed full for Timeout milliseconds.
+*/
+HS_QD3XX_API FT_STATUS HS_WriteQueueBatch(HS_QUEUE Queue, PUCHAR *WriteBuffers, PULONG Lengths, ULONG Count, PULONG Accepted, DWORD Timeout);
+
+/*
+	Points WriteBuffer at an empty StreamSize buffer from the queue so data can be written into it in place.
+	Fails if queue is for an IN pipe.
+	Returns FT_BUSY if the queue is full and Timeout is 0, FT_TIMEOUT if it stayed full for Timeout milliseconds.
+	The buffer must be passed to HS_CommitWriteBuffer() before it is written out or reused.
+*/
+HS_QD3XX_API FT_STATUS HS_AcquireWriteBuffer(HS_QUEUE Queue, PUCHAR *WriteBuffer, DWORD Timeout);
+
+/*
+	Queues the first Length bytes of a buffer from HS_AcquireWriteBuffer() to be written out.
+	Length can't be more than StreamSize. A Length of 0 gives the buffer back without writing it.
+*/
+HS_QD3XX_API FT_STATUS HS_CommitWriteBuffer(HS_QUEUE Queue, PUCHAR WriteBuffer, ULONG Length);
+
 /*
 	Get the status of the oldest write in the queue.
 	Will destroy the queue if the pipe has been aborted and needs to undergo the abort procedure.
 */
 HS_QD3XX_API FT_STATUS HS_GetWriteStatus(HS_QUEUE *Queue, PULONG BytesTransferred, BOOL Wait);
 
+/*
+	Same as HS_GetWriteStatus() but waits up to Timeout milliseconds for a write to finish.
+	Returns FT_TIMEOUT if the time ran out. A Timeout of 0 acts like Wait = FALSE and INFINITE like Wait = TRUE.
+*/
+HS_QD3XX_API FT_STATUS HS_GetWriteStatusTimeout(HS_QUEUE *Queue, PULONG BytesTransferred, DWORD Timeout);
+
+/*
+	Same as HS_GetWriteStatusTimeout() but also gets the number of bytes the write asked for in Length.
+	BytesTransferred less than Length means a short write. Length can be NULL.
+*/
+HS_QD3XX_API FT_STATUS HS_GetWriteStatusEx(HS_QUEUE *Queue, PULONG BytesTransferred, PULONG Length, DWORD Timeout);
+
+/*
+	Gets the statuses of up to MaxCount finished writes in order, Count is set to how many were gotten.
+	BytesTransferred and Lengths are arrays of MaxCount like HS_GetWriteStatusEx()'s, either can be NULL.
+	Waits up to Timeout milliseconds for the first write like HS_GetWriteStatusTimeout(), then takes every write that's done.
+	If a write failed after others were gotten, those are returned with FT_OK and the next call fails with its status.
+*/
+HS_QD3XX_API FT_STATUS HS_GetWriteStatusBatch(HS_QUEUE *Queue, PULONG BytesTransferred, PULONG Lengths, ULONG MaxCount, PULONG Count, DWORD Timeout);
+
+/*
+	Caps how many read/write pipe calls of the queue are in flight at the driver at once, from 1 to QueueLength.
+	Queues start at QueueLength. Buffers past the cap wait in the queue until an earlier call finishes.
+	A deeper OUT queue keeps the bus busy between writes, a shallower one keeps fewer bytes committed to the driver.
+*/
+HS_QD3XX_API FT_STATUS HS_SetQueueDepth(HS_QUEUE Queue, ULONG Depth);
+
+/*
+	Gets how many read/write pipe calls of the queue are in flight right now.
+*/
+HS_QD3XX_API FT_STATUS HS_GetQueueInFlight(HS_QUEUE Queue, PULONG InFlight);
+
+/*
+	Keeps a stalled pipe from blocking the queue forever. PipeTimeoutMs is given to FT_SetPipeTimeout(), 0 leaves it as is.
+	If StallMs isn't 0, a watchdog aborts the pipe once no read/write in flight has finished for StallMs.
+	Transfers that time out or are aborted by the watchdog are posted again from the same buffers instead of failing,
+	so the queue stays usable and Stalls in HS_QUEUE_STATS goes up. Only the transfers that failed or hadn't finished
+	are posted again, writes that finished aren't sent twice. After a few stalls in a row without a transfer finishing,
+	the failure is handed to the user. Until this is called, FT_TIMEOUT from the driver fails the transfer as usual.
+*/
+HS_QD3XX_API FT_STATUS HS_SetQueueTimeout(HS_QUEUE Queue, DWORD PipeTimeoutMs, ULONG StallMs);
+
+/*
+	Stops the queue from making read/write pipe calls until HS_ResumeQueue(). Its thread, buffers and overlaps stay.
+	Reads/writes in flight finish as usual, unless Flags has HS_PAUSE_ABORT. Then they're aborted and waited for,
+	and are made again on resume. Writes queued while paused wait for resume. A callback must not abort its own queue.
+*/
+HS_QD3XX_API FT_STATUS HS_PauseQueue(HS_QUEUE Queue, ULONG Flags);
+
+/*
+	Lets a paused queue make read/write pipe calls again.
+*/
+HS_QD3XX_API FT_STATUS HS_ResumeQueue(HS_QUEUE Queue);
+
+/*
+	Discards finished reads the user hasn't gotten yet (IN) or write statuses the user hasn't gotten yet (OUT), then
+	sets Discarded to how many, if not NULL. A paused OUT queue with nothing in flight also discards its queued writes.
+	A lock free queue's thread may be making a write pipe call as the pause lands, that write is aborted and discarded too.
+	Held buffers are kept. Lock free queues must not be read/written or have write statuses gotten at the same time.
+*/
+HS_QD3XX_API FT_STATUS HS_FlushQueue(HS_QUEUE Queue, PULONG Discarded);
+
+/*
+	Gets the number of heap allocations the queue has made for its buffers.
+	Every buffer is allocated by HS_CreateQueue(), so this doesn't change while the queue runs.
+*/
+HS_QD3XX_API FT_STATUS HS_GetQueueAllocations(HS_QUEUE Queue, PULONG Allocations);
+
+/*
+	Gets the queue's counters, see HS_QUEUE_STATS. Safe to call from any thread while the queue runs.
+	Counters are read one at a time without stopping the queue, so they can be a transfer apart from each other.
+	An IN queue is full when the user holds or hasn't read every buffer, an OUT queue when no buffer is free to write.
+*/
+HS_QD3XX_API FT_STATUS HS_GetQueueStats(HS_QUEUE Queue, HS_QUEUE_STATS *Stats);
+
+/*
+	Gets a non-blocking eventfd that becomes readable when a read or write of the queue finishes, for epoll/poll/select.
+	Read 8 bytes from it to clear it, then empty the queue with a Timeout of 0 until it returns FT_NO_MORE_ITEMS,
+	FT_IO_INCOMPLETE or FT_IO_PENDING. It can be readable with nothing left to take, that's harmless.
+	Every call returns the same fd. It belongs to the queue and is closed by HS_DestroyQueue(), remove it from
+	epoll first. Linux only, Windows returns FT_NOT_SUPPORTED. Callback queues return FT_NOT_SUPPORTED.
+*/
+HS_QD3XX_API FT_STATUS HS_GetQueueEventFd(HS_QUEUE Queue, int *EventFd);
+
+/*
+	Waits up to Timeout milliseconds until any of Count queues has a finished read (IN) or write status (OUT).
+	Bit i of ReadyMask is set if Queues[i] is ready, then take from those queues with a Timeout of 0.
+	Count is 1 to HS_WAIT_ANY_MAX. Returns FT_TIMEOUT with ReadyMask 0 if none got ready in time.
+	Must be called from the thread that reads/gets write statuses of lock free queues. The queues must not be
+	destroyed while waited on. Callback queues can't be waited on.
+*/
+HS_QD3XX_API FT_STATUS HS_WaitAny(HS_QUEUE *Queues, ULONG Count, DWORD Timeout, PULONG ReadyMask);
+
+/*
+	Gets the latency histogram of a HS_QUEUE_TIMING queue for Stage, one of the HS_LATENCY_ values.
+	Returns FT_NOT_SUPPORTED if the queue wasn't made with HS_QUEUE_TIMING. Safe to call while the queue runs.
+	Transfers that fail are timed up to HS_LATENCY_DEVICE, the user never gets them.
+*/
+HS_QD3XX_API FT_STATUS HS_GetQueueLatency(HS_QUEUE Queue, ULONG Stage, HS_LATENCY_HISTOGRAM *Histogram);
+
+/*
+	Returns the value Percentile (0 to 100) percent of the histogram's values are at or below, in nanoseconds.
+	Rounded up to the end of its bucket but never above MaxNs. Returns 0 for an empty histogram.
+*/
+HS_QD3XX_API ULONGLONG HS_GetLatencyPercentile(const HS_LATENCY_HISTOGRAM *Histogram, double Percentile);
+
+/*
+	Makes the library call Backend instead of the D3XX library, NULL goes back to the D3XX library.
+	Call before HS_Open(), fails with FT_BUSY while any queue exists.
+	Libraries built with _QUEUE_D3XX_SIM_ONLY go back to the simulated device instead.
+*/
+HS_QD3XX_API FT_STATUS HS_SetBackend(const HS_D3XX_BACKEND *Backend);
+
+/*
+	Gets the backend the library is calling, so a new backend can wrap it.
+*/
+HS_QD3XX_API FT_STATUS HS_GetBackend(HS_D3XX_BACKEND *Backend);
+
+/*
+	Makes the library use a simulated device instead of the D3XX library, see HS_SIM_CONFIG. NULL Config is all 0.
+	Devices opened after this use Config. Fails with FT_BUSY while any queue exists.
+	The simulated device has OUT pipes 0x02 to 0x05 and IN pipes 0x82 to 0x85.
+	Reads get a count of the pipe's reads written to their first 8 bytes and the time they finished in the next 8.
+	The time is in nanoseconds of CLOCK_MONOTONIC on Linux and of QueryPerformanceCounter() on Windows.
+*/
+HS_QD3XX_API FT_STATUS HS_UseSimD3XX(const HS_SIM_CONFIG *Config);
+
 /*
 	You must call this on program exit if you didn't destroy all queues.
 	This will cleanup everything even if you didn't destroy all queues.
@@ -0,0 +1,240 @@
+#include "QueueD3XX.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+    #include <pthread.h>
+    #include <time.h>
+    #include <sys/resource.h>
+#endif //_WIN32
+
+//Throughput/latency sweep of HS_ReadQueue(), HS_WriteQueue() and HS_GetWriteStatus() against the simulated device.
+//Prints one CSV row per operation and configuration so runs of different releases can be compared.
+//Usage: bench [QueueFlags [BytesPerSecond [LatencyUs]]], QueueFlags are HS_QUEUE_ flags for HS_CreateQueueEx().
+#define MAX_CHANNELS 4
+#define MAX_STREAM_SIZE 1024 * 1024
+#define BYTES_PER_RUN 64 * 1024 * 1024 //Bytes each channel moves per configuration, within the limits below.
+#define MIN_TRANSFERS 200
+#define MAX_TRANSFERS 20000
+
+ULONG StreamSizes[] = {4 * 1024, 64 * 1024, MAX_STREAM_SIZE};
+ULONG QueueLengths[] = {4, 16, 64};
+ULONG ChannelCounts[] = {1, MAX_CHANNELS};
+
+typedef struct _Channel{
+    HS_QUEUE Queue;
+    ULONG StreamSize;
+    ULONG Transfers;
+    ULONGLONG *Latency; //Read: finish to HS_ReadQueue() return. Write: time in HS_WriteQueue().
+    ULONGLONG *StatusLatency; //Time in HS_GetWriteStatus().
+    ULONG StatusCount;
+    ULONGLONG Bytes;
+    FT_STATUS Status;
+} Channel;
+
+//Same clock as the library, the simulated device stamps reads with it.
+ULONGLONG TimeNs()
+{
+    #ifdef _WIN32
+        LARGE_INTEGER Count, Frequency;
+        QueryPerformanceCounter(&Count);
+        QueryPerformanceFrequency(&Frequency);
+        return (ULONGLONG)((Count.QuadPart / Frequency.QuadPart) * 1000000000ULL +
+                           ((Count.QuadPart % Frequency.QuadPart) * 1000000000ULL) / Frequency.QuadPart);
+    #else
+        struct timespec Now;
+        clock_gettime(CLOCK_MONOTONIC, &Now);
+        return (ULONGLONG)Now.tv_sec * 1000000000ULL + (ULONGLONG)Now.tv_nsec;
+    #endif //_WIN32
+}
+
+//User + kernel CPU time of the whole process in nanoseconds.
+ULONGLONG CpuNs()
+{
+    #ifdef _WIN32
+        FILETIME Create, Exit, Kernel, User;
+        GetProcessTimes(GetCurrentProcess(), &Create, &Exit, &Kernel, &User);
+        return ((((ULONGLONG)Kernel.dwHighDateTime << 32) | Kernel.dwLowDateTime) +
+                (((ULONGLONG)User.dwHighDateTime << 32) | User.dwLowDateTime)) * 100ULL;
+    #else
+        struct rusage Usage;
+        getrusage(RUSAGE_SELF, &Usage);
+        return ((ULONGLONG)Usage.ru_utime.tv_sec + Usage.ru_stime.tv_sec) * 1000000000ULL +
+               ((ULONGLONG)Usage.ru_utime.tv_usec + Usage.ru_stime.tv_usec) * 1000ULL;
+    #endif //_WIN32
+}
+
+int CompareTimes(const void *A, const void *B)
+{
+    ULONGLONG X = *(const ULONGLONG *)A, Y = *(const ULONGLONG *)B;
+    return (X > Y) - (X < Y);
+}
+
+#ifdef _WIN32
+DWORD WINAPI ReadChannel(LPVOID Argument)
+#else
+void *ReadChannel(void *Argument)
+#endif //_WIN32
+{
+    Channel *Chan = Argument;
+    PUCHAR Data = malloc(Chan->StreamSize);
+    ULONGLONG Done;
+    ULONG BytesTransferred;
+    Chan->Status = Data ? FT_OK : FT_NO_SYSTEM_RESOURCES;
+    for(ULONG i = 0; (i < Chan->Transfers) && (Chan->Status == FT_OK); ++i)
+    {
+        Chan->Status = HS_ReadQueue(&Chan->Queue, Data, &BytesTransferred, TRUE);
+        if(Chan->Status != FT_OK){break;}
+        memcpy(&Done, Data + sizeof(ULONGLONG), sizeof(ULONGLONG)); //When the simulated device finished the read.
+        Chan->Latency[i] = TimeNs() - Done;
+        Chan->Bytes += BytesTransferred;
+    }
+    free(Data);
+    return 0;
+}
+
+#ifdef _WIN32
+DWORD WINAPI WriteChannel(LPVOID Argument)
+#else
+void *WriteChannel(void *Argument)
+#endif //_WIN32
+{
+    Channel *Chan = Argument;
+    PUCHAR Data = calloc(1, Chan->StreamSize);
+    ULONGLONG Start;
+    ULONG BytesTransferred;
+    Chan->Status = Data ? FT_OK : FT_NO_SYSTEM_RESOURCES;
+    for(ULONG i = 0; (i < Chan->Transfers) && (Chan->Status == FT_OK); ++i)
+    {
+        Start = TimeNs();
+        while((Chan->Status = HS_WriteQueue(Chan->Queue, Data, FALSE)) == FT_BUSY) //Queue is full, get a status to free a buffer.
+        {
+            ULONGLONG StatusStart = TimeNs();
+            Chan->Status = HS_GetWriteStatus(&Chan->Queue, &BytesTransferred, TRUE);
+            Chan->StatusLatency[Chan->StatusCount++] = TimeNs() - StatusStart;
+            Chan->Bytes += BytesTransferred;
+            if(Chan->Status != FT_OK){break;}
+            Start = TimeNs(); //Only time the write itself.
+        }
+        Chan->Latency[i] = TimeNs() - Start;
+    }
+    while(Chan->Status == FT_OK) //Wait for the last writes.
+    {
+        ULONGLONG StatusStart = TimeNs();
+        if(HS_GetWriteStatus(&Chan->Queue, &BytesTransferred, TRUE) != FT_OK){break;}
+        Chan->StatusLatency[Chan->StatusCount++] = TimeNs() - StatusStart;
+        Chan->Bytes += BytesTransferred;
+    }
+    free(Data);
+    return 0;
+}
+
+//Prints a CSV row. Throughput covers the whole run of the operation's queues.
+void PrintRow(const char *Op, ULONG StreamSize, ULONG QueueLength, ULONG Channels, BOOL Fixed, ULONG Flags,
+              ULONGLONG Transfers, ULONGLONG Bytes, ULONGLONG WallNs, ULONGLONG CpuUsed, ULONGLONG *Times, ULONGLONG Count)
+{
+    double Seconds = (double)WallNs / 1e9;
+    qsort(Times, (size_t)Count, sizeof(ULONGLONG), CompareTimes);
+    printf("%s,%lu,%lu,%lu,%d,%lu,%llu,%llu,%.6f,%.1f,%.0f,%llu,%llu,%llu,%.4f\n", Op, (unsigned long)StreamSize,
+           (unsigned long)QueueLength, (unsigned long)Channels, Fixed ? 1 : 0, (unsigned long)Flags, Transfers, Bytes,
+           Seconds, (double)Bytes / 1e6 / Seconds, (double)Transfers / Seconds,
+           Count ? Times[Count / 2] : 0, Count ? Times[(Count * 99) / 100] : 0, Count ? Times[(Count * 999) / 1000] : 0,
+           Bytes ? ((double)CpuUsed / 1e9) / ((double)Bytes / 1e9) : 0.0);
+}
+
+//Runs one configuration for reads (IN pipes) or writes (OUT pipes) and prints its rows.
+FT_STATUS RunConfig(FT_HANDLE Handle, BOOL Read, ULONG StreamSize, ULONG QueueLength, ULONG Channels, BOOL Fixed, ULONG Flags,
+                    Channel *Chans, ULONGLONG *Times, ULONGLONG *StatusTimes)
+{
+    FT_STATUS Status = FT_OK;
+    ULONG Transfers = (ULONG)(BYTES_PER_RUN / StreamSize);
+    ULONGLONG Start, CpuStart, Bytes = 0, Count = 0, StatusCount = 0;
+    if(Transfers < MIN_TRANSFERS){Transfers = MIN_TRANSFERS;}
+    if(Transfers > MAX_TRANSFERS){Transfers = MAX_TRANSFERS;}
+    #ifdef _WIN32
+        HANDLE Threads[MAX_CHANNELS];
+    #else
+        pthread_t Threads[MAX_CHANNELS];
+    #endif //_WIN32
+    for(ULONG i = 0; i < Channels; ++i)
+    {
+        memset(&Chans[i], 0, sizeof(Channel));
+        Chans[i].StreamSize = StreamSize;
+        Chans[i].Transfers = Transfers;
+        Chans[i].Latency = Times + (size_t)i * MAX_TRANSFERS;
+        Chans[i].StatusLatency = StatusTimes + (size_t)i * MAX_TRANSFERS;
+        Status = HS_CreateQueueEx(Handle, (Read ? 0x82 : 0x02) + i, StreamSize, QueueLength,
+                                  Flags | (Fixed ? HS_QUEUE_FIXED : 0), &Chans[i].Queue);
+        if(Status != FT_OK){printf("ERROR: HS_CreateQueueEx returned %i\n", Status); return Status;}
+    }
+    Start = TimeNs();
+    CpuStart = CpuNs();
+    for(ULONG i = 0; i < Channels; ++i)
+    {
+        #ifdef _WIN32
+            Threads[i] = CreateThread(NULL, 0, Read ? ReadChannel : WriteChannel, &Chans[i], 0, NULL);
+        #else
+            pthread_create(&Threads[i], NULL, Read ? ReadChannel : WriteChannel, &Chans[i]);
+        #endif //_WIN32
+    }
+    for(ULONG i = 0; i < Channels; ++i)
+    {
+        #ifdef _WIN32
+            WaitForSingleObject(Threads[i], INFINITE);
+            CloseHandle(Threads[i]);
+        #else
+            pthread_join(Threads[i], NULL);
+        #endif //_WIN32
+    }
+    Start = TimeNs() - Start;
+    CpuStart = CpuNs() - CpuStart;
+    for(ULONG i = 0; i < Channels; ++i)
+    {
+        if(Chans[i].Status != FT_OK){Status = Chans[i].Status;}
+        if(Chans[i].Queue){HS_DestroyQueue(Chans[i].Queue);}
+        //Pack every channel's samples together for the percentiles.
+        memmove(Times + Count, Chans[i].Latency, sizeof(ULONGLONG) * Transfers);
+        Count += Transfers;
+        memmove(StatusTimes + StatusCount, Chans[i].StatusLatency, sizeof(ULONGLONG) * Chans[i].StatusCount);
+        StatusCount += Chans[i].StatusCount;
+        Bytes += Chans[i].Bytes;
+    }
+    if(Status != FT_OK){printf("ERROR: %s returned %i\n", Read ? "HS_ReadQueue" : "HS_WriteQueue", Status); return Status;}
+    PrintRow(Read ? "read" : "write", StreamSize, QueueLength, Channels, Fixed, Flags, Count, Bytes, Start, CpuStart, Times, Count);
+    if(!Read){PrintRow("status", StreamSize, QueueLength, Channels, Fixed, Flags, StatusCount, Bytes, Start, CpuStart, StatusTimes, StatusCount);}
+    return FT_OK;
+}
+
+int main(int argc, char **argv)
+{
+    FT_STATUS Status = FT_OK;
+    FT_HANDLE Handle = 0;
+    HS_SIM_CONFIG Sim;
+    Channel Chans[MAX_CHANNELS];
+    ULONG Flags = (argc > 1) ? strtoul(argv[1], NULL, 0) : 0;
+    ULONGLONG *Times = malloc(sizeof(ULONGLONG) * MAX_TRANSFERS * MAX_CHANNELS);
+    ULONGLONG *StatusTimes = malloc(sizeof(ULONGLONG) * MAX_TRANSFERS * MAX_CHANNELS);
+    if(!Times || !StatusTimes){return 1;}
+    memset(&Sim, 0, sizeof(Sim));
+    Sim.BytesPerSecond = (argc > 2) ? strtoull(argv[2], NULL, 0) : 0;
+    Sim.LatencyUs = (argc > 3) ? strtoul(argv[3], NULL, 0) : 0;
+    Status = HS_UseSimD3XX(&Sim);
+    if(Status != FT_OK){printf("ERROR: HS_UseSimD3XX returned %i\n", Status); return Status;}
+    Status = HS_Open(0, FT_OPEN_BY_INDEX, &Handle);
+    if(Status != FT_OK){printf("ERROR: HS_Open returned %i\n", Status); return Status;}
+    printf("# QueueD3XX %08X, simulated device %llu B/s %lu us\n", HS_GetVersionQueueD3XX(), Sim.BytesPerSecond, (unsigned long)Sim.LatencyUs);
+    printf("op,stream_size,queue_length,channels,fixed,flags,transfers,bytes,seconds,mb_per_s,transfers_per_s,p50_ns,p99_ns,p999_ns,cpu_s_per_gb\n");
+    for(int Read = 1; (Read >= 0) && (Status == FT_OK); --Read)
+    for(size_t s = 0; (s < sizeof(StreamSizes) / sizeof(ULONG)) && (Status == FT_OK); ++s)
+    for(size_t q = 0; (q < sizeof(QueueLengths) / sizeof(ULONG)) && (Status == FT_OK); ++q)
+    for(size_t c = 0; (c < sizeof(ChannelCounts) / sizeof(ULONG)) && (Status == FT_OK); ++c)
+    for(int Fixed = 0; (Fixed < 2) && (Status == FT_OK); ++Fixed)
+    {
+        Status = RunConfig(Handle, Read, StreamSizes[s], QueueLengths[q], ChannelCounts[c], Fixed, Flags, Chans, Times, StatusTimes);
+        fflush(stdout);
+    }
+    HS_FreeQueueD3XX();
+    HS_Close(Handle);
+    free(Times); free(StatusTimes);
+    return Status;
+}
@@ -0,0 +1,109 @@
+#include "QueueD3XX.h"
+#include <stdio.h>
+#include <stdlib.h>
+#ifndef _WIN32
+    #include <time.h>
+#endif //_WIN32
+
+//Compares handing buffers between the queue's thread and the user with BuffersMutex and with HS_QUEUE_LOCK_FREE.
+//Needs a device at index 0 that streams on pipe 0x82 and accepts writes on pipe 0x02.
+#define STREAM_SIZE 4 * 1024
+#define QUEUE_SIZE 64
+#define TRANSFERS 200000
+
+ULONGLONG TimeNs()
+{
+    #ifdef _WIN32
+        LARGE_INTEGER Count, Frequency;
+        QueryPerformanceCounter(&Count);
+        QueryPerformanceFrequency(&Frequency);
+        return (ULONGLONG)((double)Count.QuadPart * 1000000000.0 / (double)Frequency.QuadPart);
+    #else
+        struct timespec Now;
+        clock_gettime(CLOCK_MONOTONIC, &Now);
+        return (ULONGLONG)Now.tv_sec * 1000000000ULL + (ULONGLONG)Now.tv_nsec;
+    #endif //_WIN32
+}
+
+int CompareTimes(const void *A, const void *B)
+{
+    ULONGLONG X = *(const ULONGLONG *)A, Y = *(const ULONGLONG *)B;
+    return (X > Y) - (X < Y);
+}
+
+//Prints ns per transfer and the percentiles of how long each acquire call took.
+void PrintResult(const char *Name, ULONG Flags, ULONGLONG Total, ULONGLONG *Times)
+{
+    qsort(Times, TRANSFERS, sizeof(ULONGLONG), CompareTimes);
+    printf("%-6s %-9s %8.1f ns/transfer  acquire p50 %6llu ns  p99 %7llu ns  p999 %8llu ns\n", Name,
+           (Flags & HS_QUEUE_LOCK_FREE) ? "lock-free" : "mutex", (double)Total / TRANSFERS,
+           Times[TRANSFERS / 2], Times[(TRANSFERS / 100) * 99], Times[(TRANSFERS / 1000) * 999]);
+}
+
+FT_STATUS BenchRead(FT_HANDLE Handle, ULONG Flags, ULONGLONG *Times)
+{
+    FT_STATUS Status;
+    HS_QUEUE Queue = NULL;
+    PUCHAR Data;
+    ULONG BytesTransferred;
+    ULONGLONG Start, Before;
+    Status = HS_CreateQueueEx(Handle, 0x82, STREAM_SIZE, QUEUE_SIZE, Flags, &Queue);
+    if(Status != FT_OK){printf("ERROR: HS_CreateQueueEx returned %i\n", Status); return Status;}
+    Start = TimeNs();
+    for(int i = 0; i < TRANSFERS; ++i)
+    {
+        Before = TimeNs();
+        Status = HS_AcquireReadBuffer(&Queue, &Data, &BytesTransferred, INFINITE);
+        Times[i] = TimeNs() - Before;
+        if(Status != FT_OK){printf("ERROR: HS_AcquireReadBuffer returned %i\n", Status); return Status;}
+        HS_ReleaseReadBuffer(Queue, Data);
+    }
+    PrintResult("read", Flags, TimeNs() - Start, Times);
+    return HS_DestroyQueue(Queue);
+}
+
+FT_STATUS BenchWrite(FT_HANDLE Handle, ULONG Flags, ULONGLONG *Times)
+{
+    FT_STATUS Status;
+    HS_QUEUE Queue = NULL;
+    PUCHAR Data;
+    ULONG BytesTransferred;
+    ULONGLONG Start, Before;
+    Status = HS_CreateQueueEx(Handle, 0x02, STREAM_SIZE, QUEUE_SIZE, Flags, &Queue);
+    if(Status != FT_OK){printf("ERROR: HS_CreateQueueEx returned %i\n", Status); return Status;}
+    Start = TimeNs();
+    for(int i = 0; i < TRANSFERS; ++i)
+    {
+        Before = TimeNs();
+        while((Status = HS_AcquireWriteBuffer(Queue, &Data, 0)) == FT_BUSY) //Make room by getting write statuses.
+        {
+            Status = HS_GetWriteStatusTimeout(&Queue, &BytesTransferred, INFINITE);
+            if(Status != FT_OK){break;}
+        }
+        Times[i] = TimeNs() - Before;
+        if(Status != FT_OK){printf("ERROR: HS_AcquireWriteBuffer returned %i\n", Status); return Status;}
+        Data[0] = (UCHAR)i;
+        HS_CommitWriteBuffer(Queue, Data, STREAM_SIZE);
+    }
+    while(HS_GetWriteStatusTimeout(&Queue, &BytesTransferred, INFINITE) == FT_OK); //Wait for the last writes.
+    PrintResult("write", Flags, TimeNs() - Start, Times);
+    return HS_DestroyQueue(Queue);
+}
+
+int main()
+{
+    printf("Version: %08X\n", HS_GetVersionQueueD3XX());
+    FT_STATUS Status = FT_OK;
+    FT_HANDLE Handle = 0;
+    ULONG Modes[2] = {0, HS_QUEUE_LOCK_FREE};
+    ULONGLONG *Times = malloc(sizeof(ULONGLONG) * TRANSFERS);
+    if(!Times){return 1;}
+    Status = HS_Open(0, FT_OPEN_BY_INDEX, &Handle);
+    if(Status != FT_OK){printf("ERROR: HS_Open returned %i\n", Status); return Status;}
+    for(int i = 0; (i < 2) && (Status == FT_OK); ++i){Status = BenchRead(Handle, Modes[i], Times);}
+    for(int i = 0; (i < 2) && (Status == FT_OK); ++i){Status = BenchWrite(Handle, Modes[i], Times);}
+    HS_FreeQueueD3XX();
+    HS_Close(Handle);
+    free(Times);
+    return Status;
+}
@@ -0,0 +1,201 @@
+#include "QueueD3XX.h"
+#include <stdio.h>
+#include <string.h>
+
+//Checks that recovering from failed or aborted transfers against the simulated device neither loses nor repeats any.
+//Wraps the simulated backend to stamp every read that finishes OK and count every write pipe call.
+#define STREAM_SIZE 1024
+#define QUEUE_SIZE 16
+#define READS 3000
+#define WRITES 500
+#define PAUSE_EVERY 25 //Writes between HS_PauseQueue() calls.
+#define READ_PAUSE_EVERY 5 //Reads between HS_PauseQueue() calls.
+#define MAX_OVERLAPS 64
+
+HS_D3XX_BACKEND Sim; //The backend being wrapped.
+LPOVERLAPPED Overlaps[MAX_OVERLAPS]; //Buffer & pipe of each overlap posted, only touched by the queue's thread.
+PUCHAR Buffers[MAX_OVERLAPS];
+UCHAR Pipes[MAX_OVERLAPS];
+ULONG OverlapCount = 0;
+ULONGLONG ReadStamp = 0; //Written into the start of each read that finishes OK.
+ULONG WriteCalls = 0, FailedWrites = 0;
+ULONG Sent[WRITES]; //Times each write finished OK.
+
+void Remember(LPOVERLAPPED Overlapped, PUCHAR Buffer, UCHAR PipeID)
+{
+    ULONG i;
+    for(i = 0; (i < OverlapCount) && (Overlaps[i] != Overlapped); ++i);
+    if(i == OverlapCount){OverlapCount += 1;}
+    Overlaps[i] = Overlapped;
+    Buffers[i] = Buffer;
+    Pipes[i] = PipeID;
+}
+
+//Returns the overlap's buffer and sets PipeID to the pipe it was posted to, NULL if it wasn't posted.
+PUCHAR BufferOf(LPOVERLAPPED Overlapped, PUCHAR PipeID)
+{
+    for(ULONG i = 0; i < OverlapCount; ++i){if(Overlaps[i] == Overlapped){*PipeID = Pipes[i]; return Buffers[i];}}
+    return NULL;
+}
+
+FT_STATUS ReadPipe(FT_HANDLE Handle, UCHAR PipeID, PUCHAR Buffer, ULONG Length, PULONG BytesTransferred, LPOVERLAPPED Overlapped)
+{
+    Remember(Overlapped, Buffer, PipeID);
+    return Sim.ReadPipe(Handle, PipeID, Buffer, Length, BytesTransferred, Overlapped);
+}
+
+FT_STATUS WritePipe(FT_HANDLE Handle, UCHAR PipeID, PUCHAR Buffer, ULONG Length, PULONG BytesTransferred, LPOVERLAPPED Overlapped)
+{
+    Remember(Overlapped, Buffer, PipeID);
+    WriteCalls += 1;
+    return Sim.WritePipe(Handle, PipeID, Buffer, Length, BytesTransferred, Overlapped);
+}
+
+FT_STATUS GetOverlappedResult(FT_HANDLE Handle, LPOVERLAPPED Overlapped, PULONG BytesTransferred, BOOL Wait)
+{
+    FT_STATUS Status = Sim.GetOverlappedResult(Handle, Overlapped, BytesTransferred, Wait);
+    UCHAR PipeID = 0;
+    PUCHAR Buffer = BufferOf(Overlapped, &PipeID);
+    ULONG Sequence;
+    if(!Buffer || (Status == FT_IO_INCOMPLETE)){return Status;}
+    if(PipeID & 0x80)
+    {
+        if(Status == FT_OK){memcpy(Buffer, &ReadStamp, sizeof(ULONGLONG)); ReadStamp += 1;}
+    }
+    else if(Status == FT_OK)
+    {
+        memcpy(&Sequence, Buffer, sizeof(ULONG));
+        if(Sequence < WRITES){Sent[Sequence] += 1;}
+    }
+    else{FailedWrites += 1;}
+    return Status;
+}
+
+//Sets up the simulated device with a failure every ErrorEvery transfers and wraps it.
+FT_STATUS UseSim(ULONG ErrorEvery, ULONG LatencyUs, FT_HANDLE *Handle)
+{
+    HS_SIM_CONFIG Config;
+    HS_D3XX_BACKEND Wrapped;
+    memset(&Config, 0, sizeof(Config));
+    Config.LatencyUs = LatencyUs;
+    Config.JitterUs = 4 * LatencyUs; //Later transfers often finish before a failed one.
+    Config.ErrorEvery = ErrorEvery;
+    Config.ErrorStatus = FT_IO_ERROR;
+    Config.Seed = 1;
+    HS_UseSimD3XX(&Config);
+    HS_GetBackend(&Sim);
+    Wrapped = Sim;
+    Wrapped.ReadPipe = ReadPipe;
+    Wrapped.WritePipe = WritePipe;
+    Wrapped.GetOverlappedResult = GetOverlappedResult;
+    HS_SetBackend(&Wrapped);
+    OverlapCount = 0; ReadStamp = 0; WriteCalls = 0; FailedWrites = 0;
+    memset(Sent, 0, sizeof(Sent));
+    return HS_Open(0, FT_OPEN_BY_INDEX, Handle);
+}
+
+//Every read that finished OK must reach the user once and in order.
+int TestRead(ULONG Flags)
+{
+    FT_HANDLE Handle = NULL;
+    HS_QUEUE Queue = NULL;
+    HS_QUEUE_STATS Stats;
+    UCHAR Data[STREAM_SIZE];
+    ULONG BytesTransferred, Gaps = 0;
+    ULONGLONG Stamp;
+    FT_STATUS Status = UseSim(50, 100, &Handle);
+    if(Status == FT_OK){Status = HS_CreateQueueEx(Handle, 0x82, STREAM_SIZE, QUEUE_SIZE, Flags | HS_QUEUE_RECOVER, &Queue);}
+    for(ULONGLONG i = 0; (i < READS) && (Status == FT_OK); ++i)
+    {
+        Status = HS_ReadQueueTimeout(&Queue, Data, &BytesTransferred, 1000);
+        memcpy(&Stamp, Data, sizeof(ULONGLONG));
+        if(Stamp != i){Gaps += 1;}
+    }
+    HS_GetQueueStats(Queue, &Stats);
+    HS_DestroyQueue(Queue);
+    HS_Close(Handle);
+    printf("read  flags %02X: status %i, %llu recoveries, %lu out of order\n", Flags, Status,
+           (unsigned long long)Stats.Recoveries, (unsigned long)Gaps);
+    return (Status != FT_OK) || Gaps || !Stats.Recoveries;
+}
+
+//Reads must keep coming after each resume. Reads are slow so every pause aborts them all and the user has none left,
+//only HS_ResumeQueue() can get the thread going again.
+int TestPauseRead(ULONG Flags)
+{
+    FT_HANDLE Handle = NULL;
+    HS_QUEUE Queue = NULL;
+    UCHAR Data[STREAM_SIZE];
+    ULONG BytesTransferred, Gaps = 0;
+    ULONGLONG Stamp;
+    FT_STATUS Status = UseSim(0, 1000, &Handle);
+    if(Status == FT_OK){Status = HS_CreateQueueEx(Handle, 0x82, STREAM_SIZE, QUEUE_SIZE, Flags, &Queue);}
+    for(ULONGLONG i = 0; (i < READS) && (Status == FT_OK); ++i)
+    {
+        if(i && !(i % READ_PAUSE_EVERY)) //Aborted reads are read again on resume.
+        {
+            Status = HS_PauseQueue(Queue, HS_PAUSE_ABORT);
+            if(Status == FT_OK){Status = HS_ResumeQueue(Queue);}
+            if(Status != FT_OK){break;}
+        }
+        Status = HS_ReadQueueTimeout(&Queue, Data, &BytesTransferred, 1000);
+        memcpy(&Stamp, Data, sizeof(ULONGLONG));
+        if(Stamp != i){Gaps += 1;}
+    }
+    HS_DestroyQueue(Queue);
+    HS_Close(Handle);
+    printf("pause flags %02X: status %i reading, %lu out of order\n", Flags, Status, (unsigned long)Gaps);
+    return (Status != FT_OK) || Gaps;
+}
+
+//Only the writes that failed may be sent again. With Pause, writes are aborted by HS_PauseQueue() instead of failing.
+int TestWrite(ULONG Flags, BOOL Pause)
+{
+    FT_HANDLE Handle = NULL;
+    HS_QUEUE Queue = NULL;
+    HS_QUEUE_STATS Stats;
+    PUCHAR Data;
+    ULONG BytesTransferred, Repeats = 0;
+    FT_STATUS Status = Pause ? UseSim(0, 1000, &Handle) : UseSim(50, 100, &Handle);
+    if(Status == FT_OK){Status = HS_CreateQueueEx(Handle, 0x02, STREAM_SIZE, QUEUE_SIZE, Flags | (Pause ? 0 : HS_QUEUE_RECOVER), &Queue);}
+    for(ULONG i = 0; (i < WRITES) && (Status == FT_OK); ++i)
+    {
+        if(Pause && i && !(i % PAUSE_EVERY)) //Abort what's in flight, it's sent again on resume.
+        {
+            Status = HS_PauseQueue(Queue, HS_PAUSE_ABORT);
+            if(Status == FT_OK){Status = HS_ResumeQueue(Queue);}
+            if(Status != FT_OK){break;}
+        }
+        while((Status = HS_AcquireWriteBuffer(Queue, &Data, 0)) == FT_BUSY) //Make room by getting write statuses.
+        {
+            Status = HS_GetWriteStatusTimeout(&Queue, &BytesTransferred, 1000);
+            if(Status != FT_OK){break;}
+        }
+        if(Status != FT_OK){break;}
+        memcpy(Data, &i, sizeof(ULONG));
+        Status = HS_CommitWriteBuffer(Queue, Data, STREAM_SIZE);
+    }
+    while((Status == FT_OK) && (HS_GetWriteStatusTimeout(&Queue, &BytesTransferred, 1000) == FT_OK)); //Wait for the last writes.
+    HS_GetQueueStats(Queue, &Stats);
+    HS_DestroyQueue(Queue);
+    HS_Close(Handle);
+    for(ULONG i = 0; i < WRITES; ++i){if(Sent[i] != 1){Repeats += 1;}}
+    printf("%s flags %02X: status %i, %llu recoveries, %lu write calls for %u writes and %lu failures, %lu not sent once\n",
+           Pause ? "pause" : "write", Flags, Status, (unsigned long long)Stats.Recoveries, (unsigned long)WriteCalls, WRITES,
+           (unsigned long)FailedWrites, (unsigned long)Repeats);
+    return (Status != FT_OK) || Repeats || (WriteCalls != WRITES + FailedWrites) || !(Pause ? FailedWrites : Stats.Recoveries);
+}
+
+int main()
+{
+    int Failed = 0;
+    ULONG Modes[3] = {0, HS_QUEUE_LOCK_FREE, HS_QUEUE_REACTOR};
+    printf("Version: %08X\n", HS_GetVersionQueueD3XX());
+    for(int i = 0; i < 3; ++i){Failed += TestRead(Modes[i]);}
+    for(int i = 0; i < 3; ++i){Failed += TestWrite(Modes[i], FALSE);}
+    for(int i = 0; i < 3; ++i){Failed += TestWrite(Modes[i], TRUE);}
+    for(int i = 0; i < 3; ++i){Failed += TestPauseRead(Modes[i]);}
+    HS_FreeQueueD3XX();
+    printf("%s\n", Failed ? "FAILED" : "PASSED");
+    return Failed;
+}